@@ -0,0 +1,60 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdint.h>
+
+#include "pysim.h"
+
+// How long each throughput benchmark runs
+#ifndef BENCH_DURATION_MS
+  #define BENCH_DURATION_MS 5000
+#endif
+
+// Round trips measured per payload size
+#ifndef BENCH_RTT_SAMPLES
+  #define BENCH_RTT_SAMPLES 500
+#endif
+
+// Wi-Fi reconfigurations measured per mode
+#ifndef BENCH_WIFI_SAMPLES
+  #define BENCH_WIFI_SAMPLES 100
+#endif
+
+// Frames sent per size by the transmit benchmarks
+#ifndef BENCH_FRAMES
+  #define BENCH_FRAMES 5000
+#endif
+
+// How far the rate delivered by a vnic shaper may be from the configured one
+#ifndef BENCH_SHAPER_TOLERANCE_PCT
+  #define BENCH_SHAPER_TOLERANCE_PCT 10
+#endif
+
+// Host end of the AP interface, see tools/pysim_controller.py --tap/--sink-port
+#ifndef BENCH_PEER_IP
+  #define BENCH_PEER_IP "192.168.4.2"
+#endif
+
+#ifndef BENCH_PEER_PORT
+  #define BENCH_PEER_PORT 5001
+#endif
+
+// Results are printed one per line as `BENCH {json}`. `params` is a JSON fragment
+// such as "\"payload\":64" identifying the configuration, or NULL.
+void bench_report_latency(const char *bench, const char *params, const ps_histogram_t *histogram);
+void bench_report_rate(const char *bench, const char *params, uint64_t packets, uint64_t bytes, int64_t elapsed_us);
+void bench_report_error(const char *bench, const char *params, const char *error);
+
+// CPU time consumed by the whole firmware so far, -1 if the target cannot tell
+int64_t bench_cpu_time_us(void);
+
+// Fills `frame` with a broadcast Ethernet frame lwIP and the controller discard
+void bench_fill_frame(uint8_t *frame, size_t len);
+
+void bench_link_rtt(void);
+void bench_wifi_bringup(void);
+void bench_frame_throughput(void);
+void bench_vnic(void);
+void bench_netif_goodput(void);
+
+#endif // _BENCH_H_
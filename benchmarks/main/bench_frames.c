@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "bench.h"
+#include "i4a_pysim.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static uint8_t frame[1600];
+
+// Counted by the interface rather than per command, since frames leave alone or batched
+static uint32_t frames_to_sim(wifi_interface_t interface) {
+    ps_wlan_stats_t stats;
+    return ps_wlan_get_stats(interface, &stats) == ESP_OK ? stats.to_sim.delivered_packets : 0;
+}
+
+// Frames queued on the vnic lwIP writes to, drained by nic_task_ap/nic_task_sta
+static void bench_tx(wifi_interface_t interface, const char *name) {
+    static const size_t sizes[] = { 64, 512, 1514 };
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        char params[48];
+        snprintf(params, sizeof(params), "\"interface\":\"%s\",\"size\":%zu", name, sizes[i]);
+        bench_fill_frame(frame, sizes[i]);
+
+        uint32_t before = frames_to_sim(interface);
+        int64_t start = esp_timer_get_time();
+        for (size_t n = 0; n < BENCH_FRAMES; n++) {
+            if (ps_wlan_send_raw(interface, frame, sizes[i]) != ESP_OK) {
+                bench_report_error("frame_tx", params, "ps_wlan_send_raw failed");
+                return;
+            }
+        }
+
+        // Wait until the nic task handed every frame to the simulator
+        int64_t deadline = start + BENCH_DURATION_MS * 1000LL * 4;
+        while (frames_to_sim(interface) - before < BENCH_FRAMES && esp_timer_get_time() < deadline) {
+            vTaskDelay(1);
+        }
+
+        uint32_t sent = frames_to_sim(interface) - before;
+        bench_report_rate("frame_tx", params, sent, (uint64_t)sent * sizes[i], esp_timer_get_time() - start);
+    }
+}
+
+// Frames that reached the vnic of the interface, queued or dropped. Taken from the vnic
+// counters rather than the link stats, which CONFIG_PYSIM_STATS may leave out.
+static uint32_t frames_from_sim(const ps_wlan_stats_t *stats) {
+    const ps_wlan_path_stats_t *path = &stats->from_sim;
+    return path->queued_packets + path->drop_no_receiver + path->drop_no_memory + path->drop_oversize + path->drop_queue_full;
+}
+
+// Frames injected by the controller (--event-rate) through event_wlan_*_rx up to the vnic rx task
+static void bench_rx(wifi_interface_t interface, const char *name) {
+    char params[32];
+    snprintf(params, sizeof(params), "\"interface\":\"%s\"", name);
+
+    ps_wlan_stats_t before, after;
+    ps_wlan_get_stats(interface, &before);
+    int64_t start = esp_timer_get_time();
+
+    vTaskDelay(pdMS_TO_TICKS(BENCH_DURATION_MS));
+
+    ps_wlan_get_stats(interface, &after);
+    int64_t elapsed = esp_timer_get_time() - start;
+    uint32_t events = frames_from_sim(&after) - frames_from_sim(&before);
+    uint32_t delivered = after.from_sim.delivered_packets - before.from_sim.delivered_packets;
+    uint32_t bytes = after.from_sim.delivered_bytes - before.from_sim.delivered_bytes;
+
+    if (events == 0) {
+        bench_report_error("frame_rx", params, "no frame events, run the controller with --event-rate");
+        return;
+    }
+
+    char rx_params[96];
+    snprintf(rx_params, sizeof(rx_params), "%s,\"events\":%" PRIu32 ",\"dropped\":%" PRIu32,
+             params, events, events > delivered ? events - delivered : 0);
+    bench_report_rate("frame_rx", rx_params, delivered, bytes, elapsed);
+}
+
+void bench_frame_throughput(void) {
+    bench_tx(WIFI_IF_AP, "ap");
+    bench_tx(WIFI_IF_STA, "sta");
+    bench_rx(WIFI_IF_AP, "ap");
+    bench_rx(WIFI_IF_STA, "sta");
+}
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "bench.h"
+#include "i4a_pysim.h"
+#include "esp_timer.h"
+
+// STA frame transmission, the most frequent command on the link
+#define BENCH_CMD 0x14
+
+static uint8_t payload[1600];
+
+void bench_link_rtt(void) {
+    static const size_t sizes[] = { 0, 16, 64, 256, 512, 1024, 1514 };
+
+    ps_link_profile_t profile;
+    ps_link_get_profile(&profile);
+    printf(
+        "BENCH {\"bench\":\"link_profile\",\"calibrated\":%s,\"rtt_us\":%" PRIu32 ",\"bytes_per_ms\":%" PRIu32
+        ",\"batch_bytes\":%" PRIu32 ",\"flush_us\":%" PRIu32 "}\n",
+        profile.calibrated ? "true" : "false", profile.rtt_us, profile.bytes_per_ms,
+        profile.batch_bytes, profile.flush_us
+    );
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        ps_histogram_t histogram = { 0 };
+        bench_fill_frame(payload, sizes[i]);
+
+        for (size_t n = 0; n < BENCH_RTT_SAMPLES; n++) {
+            int64_t start = esp_timer_get_time();
+            ps_execute(BENCH_CMD, payload, sizes[i], NULL, NULL);
+            ps_histogram_record(&histogram, esp_timer_get_time() - start);
+        }
+
+        char params[32];
+        snprintf(params, sizeof(params), "\"payload\":%zu", sizes[i]);
+        bench_report_latency("link_rtt", params, &histogram);
+    }
+}
+
+// Reconfigures both interfaces and restarts, one command per call or as one transaction.
+// Connecting is left out: it would restart the DHCP client under the later benchmarks.
+static esp_err_t wifi_bringup(bool transaction, wifi_config_t *ap, wifi_config_t *sta) {
+    if (!transaction) {
+        esp_err_t err = esp_wifi_set_mode(WIFI_MODE_APSTA);
+        if (err == ESP_OK) {
+            err = esp_wifi_set_config(WIFI_IF_AP, ap);
+        }
+        if (err == ESP_OK) {
+            err = esp_wifi_set_config(WIFI_IF_STA, sta);
+        }
+        return err == ESP_OK ? esp_wifi_start() : err;
+    }
+
+    static ps_wifi_txn_t txn;
+    ps_wifi_txn_init(&txn);
+    ps_wifi_txn_set_mode(&txn, WIFI_MODE_APSTA);
+    ps_wifi_txn_set_config(&txn, WIFI_IF_AP, ap);
+    ps_wifi_txn_set_config(&txn, WIFI_IF_STA, sta);
+    ps_wifi_txn_start(&txn);
+    return ps_wifi_txn_commit(&txn);
+}
+
+void bench_wifi_bringup(void) {
+    wifi_config_t ap = { .ap = { .ssid = "bench-ap", .password = "bench-password", .channel = 1 } };
+    wifi_config_t sta = { .sta = { .ssid = "bench-ap", .password = "bench-password" } };
+
+    for (int transaction = 0; transaction <= 1; transaction++) {
+        ps_histogram_t histogram = { 0 };
+        const char *params = transaction ? "\"mode\":\"transaction\"" : "\"mode\":\"sequential\"";
+
+        for (size_t n = 0; n < BENCH_WIFI_SAMPLES; n++) {
+            int64_t start = esp_timer_get_time();
+            if (wifi_bringup(transaction, &ap, &sta) != ESP_OK) {
+                bench_report_error("wifi_bringup", params, "reconfiguration failed");
+                break;
+            }
+            ps_histogram_record(&histogram, esp_timer_get_time() - start);
+        }
+        bench_report_latency("wifi_bringup", params, &histogram);
+    }
+}
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "bench.h"
+#include "i4a_pysim.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_log.h"
+
+#define TAG "bench"
+
+static void print_params(const char *params) {
+    if (params && params[0]) {
+        printf(",%s", params);
+    }
+}
+
+void bench_report_latency(const char *bench, const char *params, const ps_histogram_t *histogram) {
+    printf("BENCH {\"bench\":\"%s\"", bench);
+    print_params(params);
+    printf(
+        ",\"samples\":%" PRIu32 ",\"avg_us\":%" PRIu64 ",\"p50_us\":%" PRIu32 ",\"p90_us\":%" PRIu32
+        ",\"p99_us\":%" PRIu32 ",\"max_us\":%" PRIu32 "}\n",
+        histogram->count,
+        histogram->count ? histogram->sum_us / histogram->count : 0,
+        ps_histogram_percentile(histogram, 50),
+        ps_histogram_percentile(histogram, 90),
+        ps_histogram_percentile(histogram, 99),
+        histogram->max_us
+    );
+    fflush(stdout);
+}
+
+void bench_report_rate(const char *bench, const char *params, uint64_t packets, uint64_t bytes, int64_t elapsed_us) {
+    double seconds = elapsed_us > 0 ? elapsed_us / 1e6 : 1e-6;
+    printf("BENCH {\"bench\":\"%s\"", bench);
+    print_params(params);
+    printf(
+        ",\"packets\":%" PRIu64 ",\"bytes\":%" PRIu64 ",\"elapsed_us\":%" PRId64
+        ",\"pps\":%.1f,\"bps\":%.1f}\n",
+        packets, bytes, elapsed_us, packets / seconds, bytes * 8 / seconds
+    );
+    fflush(stdout);
+}
+
+void bench_report_error(const char *bench, const char *params, const char *error) {
+    printf("BENCH {\"bench\":\"%s\"", bench);
+    print_params(params);
+    printf(",\"error\":\"%s\"}\n", error);
+    fflush(stdout);
+}
+
+int64_t bench_cpu_time_us(void) {
+#if CONFIG_IDF_TARGET_LINUX
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+#else
+    return -1;
+#endif
+}
+
+void bench_fill_frame(uint8_t *frame, size_t len) {
+    static const uint8_t header[14] = {
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff,  // dst: broadcast
+        0x02, 0x00, 0x00, 0x00, 0xbe, 0x0c,  // src: locally administered
+        0x88, 0xb5,                          // ethertype: local experimental
+    };
+
+    memset(frame, 0xA5, len);
+    memcpy(frame, header, len < sizeof(header) ? len : sizeof(header));
+}
+
+#if CONFIG_PYSIM_PROFILE_LOW_MEMORY
+#define PROFILE_NAME "low_memory"
+#elif CONFIG_PYSIM_PROFILE_MAX_THROUGHPUT
+#define PROFILE_NAME "max_throughput"
+#else
+#define PROFILE_NAME "default"
+#endif
+
+// Reports the build-time tuning so results from different profiles can be told apart.
+static void report_config(void) {
+    printf(
+        "BENCH {\"bench\":\"config\",\"profile\":\"%s\",\"polling_prio\":%d,\"nic_prio\":%d,"
+        "\"vnic_rx_prio\":%d,\"vnic_rx_queue\":%d,\"spi_ring\":%d,\"event_buffer\":%d}\n",
+        PROFILE_NAME, CONFIG_PYSIM_POLLING_TASK_PRIORITY, CONFIG_I4A_NIC_TASK_PRIORITY,
+        CONFIG_VNIC_RX_TASK_PRIORITY, CONFIG_VNIC_RX_QUEUE_LEN, CONFIG_I4A_SPI_RING_SIZE,
+        CONFIG_PYSIM_EVENT_BUFFER_SIZE
+    );
+    fflush(stdout);
+}
+
+// Reports the footprint reached while running the benchmarks, per subsystem.
+static void report_memory(void) {
+    static const char *names[PS_MEM_MAX] = { "link", "vnic", "spi", "pcap" };
+    for (ps_mem_subsystem_t i = 0; i < PS_MEM_MAX; i++) {
+        ps_mem_stats_t stats;
+        ps_mem_get_stats(i, &stats);
+        printf(
+            "BENCH {\"bench\":\"memory\",\"subsystem\":\"%s\",\"static_bytes\":%" PRIu32
+            ",\"heap_high_water\":%" PRIu32 ",\"alloc_failures\":%" PRIu32
+            ",\"stack_bytes\":%" PRIu32 ",\"stack_high_water\":%" PRIu32 "}\n",
+            names[i], stats.static_bytes, stats.heap_high_water, stats.alloc_failures,
+            stats.stack_bytes, stats.stack_high_water
+        );
+    }
+
+    ps_frame_pool_stats_t pool;
+    ps_frame_pool_get_stats(&pool);
+    if (pool.enabled) {
+        printf(
+            "BENCH {\"bench\":\"frame_pool\",\"blocks\":%" PRIu32 ",\"block_size\":%" PRIu32
+            ",\"reserved_blocks\":%" PRIu32 ",\"min_free_blocks\":%" PRIu32 "}\n",
+            pool.blocks, pool.block_size, pool.reserved_blocks, pool.min_free_blocks
+        );
+    }
+    fflush(stdout);
+}
+
+// Reports how much the polling task waited on the RX pipelines, if built with them.
+static void report_rx_pipelines(void) {
+    static const char *names[] = { "sta", "ap" };
+    for (wifi_interface_t i = WIFI_IF_STA; i <= WIFI_IF_AP; i++) {
+        ps_rx_pipeline_stats_t stats;
+        if (ps_rx_pipeline_get_stats(i, &stats) != ESP_OK) {
+            return;
+        }
+        printf(
+            "BENCH {\"bench\":\"rx_pipeline\",\"interface\":\"%s\",\"queued\":%" PRIu32 ",\"processed\":%" PRIu32
+            ",\"waited\":%" PRIu32 ",\"buffers_high_water\":%" PRIu32 "}\n",
+            names[i], stats.queued, stats.processed, stats.waited, stats.buffers_high_water
+        );
+    }
+    fflush(stdout);
+}
+
+void app_main(void) {
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    i4a_pysim_init();
+
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_APSTA));
+    ESP_ERROR_CHECK(esp_wifi_start());
+
+    ESP_LOGI(TAG, "running benchmarks");
+    report_config();
+    bench_vnic();
+    bench_link_rtt();
+    bench_wifi_bringup();
+    bench_frame_throughput();
+    bench_netif_goodput();
+    ESP_LOGI(TAG, "done");
+
+    ps_stats_log();
+    ps_mem_log();
+    report_memory();
+    report_rx_pipelines();
+    printf("BENCH {\"bench\":\"done\"}\n");
+    fflush(stdout);
+}
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "bench.h"
+#include "i4a_pysim.h"
+#include "esp_timer.h"
+#include "lwip/netif.h"
+#include "lwip/sockets.h"
+
+#define UDP_PAYLOAD 1472
+
+// Everything LINK_OPT_CHECKSUM_OFFLOAD lets the simulator take over
+#define CHECKSUM_OFFLOAD_FLAGS (NETIF_CHECKSUM_GEN_IP | NETIF_CHECKSUM_GEN_UDP | NETIF_CHECKSUM_GEN_TCP | NETIF_CHECKSUM_GEN_ICMP | \
+                                NETIF_CHECKSUM_CHECK_IP | NETIF_CHECKSUM_CHECK_UDP | NETIF_CHECKSUM_CHECK_TCP | NETIF_CHECKSUM_CHECK_ICMP)
+
+static uint8_t buffer[4096];
+
+static bool peer_addr(struct sockaddr_in *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(BENCH_PEER_PORT);
+    return inet_pton(AF_INET, BENCH_PEER_IP, &addr->sin_addr) == 1;
+}
+
+// Header compression of the AP frames of the last run, in both directions
+static void report_compression(const char *bench) {
+    static const char *directions[] = { "to_sim", "from_sim" };
+
+    for (ps_wlan_direction_t direction = PS_WLAN_TO_SIM; direction <= PS_WLAN_FROM_SIM; direction++) {
+        ps_compress_stats_t stats;
+        if (ps_compress_get_stats(WIFI_IF_AP, direction, &stats) != ESP_OK || stats.frames == 0) {
+            continue;
+        }
+
+        printf(
+            "BENCH {\"bench\":\"header_compression\",\"run\":\"%s\",\"direction\":\"%s\",\"frames\":%" PRIu32
+            ",\"full\":%" PRIu32 ",\"delta\":%" PRIu32 ",\"raw\":%" PRIu32 ",\"errors\":%" PRIu32
+            ",\"ratio\":%.3f,\"cost_avg\":%" PRIu32 ",\"cost_max\":%" PRIu32 "}\n",
+            bench, directions[direction], stats.frames, stats.full_headers, stats.delta_headers, stats.raw_frames,
+            stats.errors, stats.frame_bytes ? (double)stats.link_bytes / stats.frame_bytes : 1.0,
+            stats.cost_avg, stats.cost_max
+        );
+    }
+    fflush(stdout);
+}
+
+static void bench_tcp(bool offload, bool compress) {
+    struct sockaddr_in addr;
+    peer_addr(&addr);
+
+    char params[80];
+    snprintf(params, sizeof(params), "\"csum_offload\":%d,\"compress\":%d", offload, compress);
+
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        bench_report_error("tcp_goodput", params, "connect failed, run the controller with --tap and --sink-port");
+        if (sock >= 0) {
+            close(sock);
+        }
+        return;
+    }
+
+    uint64_t sent = 0;
+    int64_t cpu_start = bench_cpu_time_us();
+    int64_t start = esp_timer_get_time();
+    int64_t end = start + BENCH_DURATION_MS * 1000LL;
+    while (esp_timer_get_time() < end) {
+        int n = send(sock, buffer, sizeof(buffer), 0);
+        if (n < 0) {
+            bench_report_error("tcp_goodput", params, "send failed");
+            close(sock);
+            return;
+        }
+        sent += n;
+    }
+
+    // Data is only delivered once the peer acknowledged it
+    shutdown(sock, SHUT_WR);
+    while (recv(sock, buffer, sizeof(buffer), 0) > 0) ;
+    close(sock);
+
+    if (cpu_start >= 0) {
+        snprintf(params + strlen(params), sizeof(params) - strlen(params), ",\"cpu_us\":%" PRId64, bench_cpu_time_us() - cpu_start);
+    }
+    bench_report_rate("tcp_goodput", params, 0, sent, esp_timer_get_time() - start);
+}
+
+static void bench_udp(bool offload, bool compress) {
+    struct sockaddr_in addr;
+    peer_addr(&addr);
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        bench_report_error("udp_goodput", NULL, "socket failed");
+        return;
+    }
+
+    uint64_t datagrams = 0, errors = 0;
+    int64_t cpu_start = bench_cpu_time_us();
+    int64_t start = esp_timer_get_time();
+    int64_t end = start + BENCH_DURATION_MS * 1000LL;
+    while (esp_timer_get_time() < end) {
+        if (sendto(sock, buffer, UDP_PAYLOAD, 0, (struct sockaddr *)&addr, sizeof(addr)) == UDP_PAYLOAD) {
+            datagrams++;
+        } else {
+            errors++;
+        }
+    }
+    close(sock);
+
+    // Offered load; the controller sink reports what actually arrived
+    char params[128];
+    int len = snprintf(params, sizeof(params), "\"payload\":%d,\"csum_offload\":%d,\"compress\":%d,\"send_errors\":%" PRIu64,
+                       UDP_PAYLOAD, offload, compress, errors);
+    if (cpu_start >= 0) {
+        snprintf(params + len, sizeof(params) - len, ",\"cpu_us\":%" PRId64, bench_cpu_time_us() - cpu_start);
+    }
+    bench_report_rate("udp_goodput", params, datagrams, datagrams * UDP_PAYLOAD, esp_timer_get_time() - start);
+}
+
+void bench_netif_goodput(void) {
+    memset(buffer, 0x5A, sizeof(buffer));
+
+    // lwIP computes every checksum first, then hands them to the simulator if it accepts.
+    // Header compression comes last, on top of the offload
+    ps_compress_enable(false);
+    ps_wlan_set_checksum_offload(WIFI_IF_AP, 0);
+    bench_tcp(false, false);
+    bench_udp(false, false);
+
+    if (ps_wlan_set_checksum_offload(WIFI_IF_AP, CHECKSUM_OFFLOAD_FLAGS) != ESP_OK) {
+        bench_report_error("tcp_goodput", "\"csum_offload\":1", "checksum offload not accepted by the simulator or lwIP");
+    } else {
+        bench_tcp(true, false);
+        bench_udp(true, false);
+    }
+
+    if (ps_compress_enable(true) != ESP_OK) {
+        bench_report_error("tcp_goodput", "\"compress\":1", "header compression not accepted by the simulator");
+        return;
+    }
+    bool offload = ps_wlan_set_checksum_offload(WIFI_IF_AP, CHECKSUM_OFFLOAD_FLAGS) == ESP_OK;
+
+    ps_compress_reset_stats();
+    bench_tcp(offload, true);
+    report_compression("tcp_goodput");
+
+    ps_compress_reset_stats();
+    bench_udp(offload, true);
+    report_compression("udp_goodput");
+}
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "bench.h"
+#include "virtual_nic.h"
+#include "vnic_pcap.h"
+#include "vnic_shaper.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+// Passes run by bench_vnic, the second one with the pcap hook enabled
+#if CONFIG_VNIC_PCAP
+  #define PCAP_PASSES 2
+#else
+  #define PCAP_PASSES 1
+#endif
+
+static struct {
+    vnic_t tx, rx;
+    size_t frames;
+    SemaphoreHandle_t done;
+} bench;
+
+static void consumer_task(void *arg) {
+    static uint8_t buffer[VNIC_MAX_LEN];
+    size_t recvd;
+
+    for (size_t n = 0; n < bench.frames; n++) {
+        vnic_receive(&bench.rx, buffer, sizeof(buffer), &recvd);
+    }
+
+    xSemaphoreGive(bench.done);
+    vTaskDelete(NULL);
+}
+
+void bench_vnic(void) {
+    static const size_t sizes[] = { 64, 512, 1514 };
+    static uint8_t frame[VNIC_MAX_LEN];
+
+    if (vnic_create(&bench.tx) != VNIC_OK || vnic_create(&bench.rx) != VNIC_OK ||
+        vnic_bind_receiver(&bench.tx, &bench.rx) != VNIC_OK) {
+        bench_report_error("vnic", NULL, "vnic_create failed");
+        return;
+    }
+    bench.done = xSemaphoreCreateBinary();
+
+    // Second pass with the pcap hook enabled, to measure what the capture costs the data path
+    for (int pcap = 0; pcap < PCAP_PASSES; pcap++) {
+        if (pcap && vnic_pcap_start(CONFIG_VNIC_PCAP_MAX_SNAPLEN, 1u << bench.tx.id) != VNIC_OK) {
+            bench_report_error("vnic", "\"pcap\":true", "vnic_pcap_start failed");
+            break;
+        }
+
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            bench_fill_frame(frame, sizes[i]);
+            bench.frames = BENCH_FRAMES;
+
+            vnic_pcap_stats_t before, after;
+            vnic_pcap_get_stats(&before);
+            int64_t start = esp_timer_get_time();
+            xTaskCreate(consumer_task, "bench_vnic_rx", 4096, NULL, tskIDLE_PRIORITY + 2, NULL);
+            for (size_t n = 0; n < bench.frames; n++) {
+                vnic_transmit(&bench.tx, frame, sizes[i]);
+            }
+            xSemaphoreTake(bench.done, portMAX_DELAY);
+            int64_t elapsed = esp_timer_get_time() - start;
+            vnic_pcap_get_stats(&after);
+
+            char params[96];
+            uint32_t captured = after.captured - before.captured;
+            snprintf(params, sizeof(params), "\"size\":%zu,\"pcap\":%s,\"pcap_cost_avg\":%" PRIu64 ",\"pcap_cost_max\":%" PRIu32,
+                     sizes[i], pcap ? "true" : "false",
+                     captured ? (after.cost_total - before.cost_total) / captured : 0, after.cost_max);
+            bench_report_rate("vnic", params, bench.frames, (uint64_t)bench.frames * sizes[i], elapsed);
+        }
+    }
+    vnic_pcap_stop();
+
+#if CONFIG_VNIC_SHAPER
+    // The delivered rate must track the configured one, whatever the sender does
+    static const uint32_t rates[] = { 10000000, 50000000 };
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        const vnic_shaper_config_t config = { .rate_bps = rates[i], .burst_bytes = 16 * 1514, .delay_us = 2000, .jitter_us = 1000 };
+        if (vnic_shaper_configure(&bench.tx, &config) != VNIC_OK) {
+            bench_report_error("vnic_shaped", NULL, "vnic_shaper_configure failed");
+            break;
+        }
+
+        bench_fill_frame(frame, 1514);
+        bench.frames = BENCH_FRAMES / 5;
+
+        vnic_shaper_stats_t before, after;
+        vnic_shaper_get_stats(&bench.tx, &before);
+        uint32_t retries = 0;
+        int64_t start = esp_timer_get_time();
+        xTaskCreate(consumer_task, "bench_vnic_rx", 4096, NULL, tskIDLE_PRIORITY + 2, NULL);
+        for (size_t n = 0; n < bench.frames; n++) {
+            // Shaped transmissions never block, back off while the shaper queue is full
+            while (vnic_transmit(&bench.tx, frame, 1514) == VNIC_BUFFER_FULL) {
+                retries++;
+                vTaskDelay(1);
+            }
+        }
+        xSemaphoreTake(bench.done, portMAX_DELAY);
+        int64_t elapsed = esp_timer_get_time() - start;
+
+        vnic_shaper_get_stats(&bench.tx, &after);
+
+        // The bucket lets its first burst through at once, the rest comes at the configured rate
+        uint64_t shaped_bits = ((uint64_t)bench.frames * 1514 - config.burst_bytes) * 8;
+        uint64_t delivered_bps = elapsed > 0 ? shaped_bits * 1000000 / elapsed : 0;
+
+        char params[160];
+        snprintf(params, sizeof(params), "\"size\":1514,\"rate_bps\":%" PRIu32 ",\"delivered_bps\":%" PRIu64
+                 ",\"retries\":%" PRIu32 ",\"throttled\":%" PRIu32,
+                 rates[i], delivered_bps, retries, after.throttled - before.throttled);
+        bench_report_rate("vnic_shaped", params, bench.frames, (uint64_t)bench.frames * 1514, elapsed);
+
+        uint64_t tolerance = (uint64_t)rates[i] * BENCH_SHAPER_TOLERANCE_PCT / 100;
+        if (delivered_bps + tolerance < rates[i] || delivered_bps > rates[i] + tolerance) {
+            bench_report_error("vnic_shaped", params, "delivered rate off the configured one");
+        }
+    }
+    vnic_shaper_disable(&bench.tx);
+#endif
+
+    vSemaphoreDelete(bench.done);
+    vnic_destroy(&bench.tx);
+    vnic_destroy(&bench.rx);
+}
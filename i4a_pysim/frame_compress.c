@@ -0,0 +1,283 @@
+#include <string.h>
+
+#include "frame_compress.h"
+#include "sdkconfig.h"
+
+#if CONFIG_I4A_HEADER_COMPRESSION
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <time.h>
+#else
+#include "esp_cpu.h"
+#endif
+
+#define FORMAT_RAW   0x00
+#define FORMAT_FULL  0x01
+#define FORMAT_DELTA 0x02
+
+// Bytes of other frames kept in slot 0, enough for ARP and most IPv6 headers
+#define GENERIC_HEADER 64
+
+#define ETH_HEADER 14
+
+static uint32_t cost_now(void) {
+#if CONFIG_IDF_TARGET_LINUX
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#else
+    return esp_cpu_get_cycle_count();
+#endif
+}
+
+static void record(frame_compress_t *self, uint8_t format, size_t frame_len, size_t link_len, uint32_t cost) {
+    portENTER_CRITICAL(&self->lock);
+    self->stats.frames++;
+    if (format == FORMAT_FULL) {
+        self->stats.full_headers++;
+    } else if (format == FORMAT_DELTA) {
+        self->stats.delta_headers++;
+    } else {
+        self->stats.raw_frames++;
+    }
+    self->stats.frame_bytes += frame_len;
+    self->stats.link_bytes += link_len;
+    self->stats.cost_total += cost;
+    if (cost > self->stats.cost_max) {
+        self->stats.cost_max = cost;
+    }
+    portEXIT_CRITICAL(&self->lock);
+}
+
+static size_t decode_error(frame_compress_t *self) {
+    portENTER_CRITICAL(&self->lock);
+    self->stats.errors++;
+    portEXIT_CRITICAL(&self->lock);
+    return 0;
+}
+
+// Returns the header length of an IPv4 TCP or UDP frame and fills `key` with its
+// flow, 0 for any other frame
+static size_t flow_header(const uint8_t *frame, size_t len, uint8_t *key) {
+    if (len < ETH_HEADER + 20 || frame[12] != 0x08 || frame[13] != 0x00 || (frame[14] >> 4) != 4) {
+        return 0;
+    }
+
+    size_t ihl = (frame[14] & 0x0F) * 4;
+    uint8_t proto = frame[23];
+    uint16_t fragment_offset = ((frame[20] << 8) | frame[21]) & 0x1FFF;
+    if (ihl < 20 || fragment_offset || (proto != 6 && proto != 17)) {
+        return 0;
+    }
+
+    size_t l4 = ETH_HEADER + ihl;
+    size_t l4_len = 8;
+    if (proto == 6) {
+        if (len < l4 + 20) {
+            return 0;
+        }
+        l4_len = (frame[l4 + 12] >> 4) * 4;
+    }
+
+    size_t header_len = l4 + l4_len;
+    if (l4_len < 8 || header_len > len || header_len > FRAME_COMPRESS_MAX_HEADER) {
+        return 0;
+    }
+
+    memcpy(key, frame, 12);             // MAC addresses
+    memcpy(key + 12, frame + 26, 8);    // IPv4 addresses
+    key[20] = proto;
+    memcpy(key + 21, frame + l4, 4);    // Ports
+    return header_len;
+}
+
+// Slot of the flow `key`, recycling the oldest flow slot if it has none
+static uint8_t flow_slot(frame_compress_t *self, const uint8_t *key) {
+    for (uint8_t i = 1; i < FRAME_COMPRESS_CONTEXTS; i++) {
+        if (self->contexts[i].valid && memcmp(self->contexts[i].key, key, FRAME_COMPRESS_KEY_LEN) == 0) {
+            return i;
+        }
+    }
+
+    uint8_t slot = self->next_slot;
+    self->next_slot = slot % (FRAME_COMPRESS_CONTEXTS - 1) + 1;
+    self->contexts[slot].valid = false;
+    memcpy(self->contexts[slot].key, key, FRAME_COMPRESS_KEY_LEN);
+    return slot;
+}
+
+void frame_compress_init(frame_compress_t *self) {
+    memset(self, 0, sizeof(*self));
+    portMUX_INITIALIZE(&self->lock);
+    self->next_slot = 1;
+}
+
+void frame_compress_reset(frame_compress_t *self) {
+    memset(self->contexts, 0, sizeof(self->contexts));
+    self->next_slot = 1;
+}
+
+bool frame_compress_set_active(frame_compress_t *self, bool active) {
+    if (active && !self->active) {
+        frame_compress_reset(self);
+    }
+    self->active = active;
+    return active;
+}
+
+size_t frame_compress_encode(frame_compress_t *self, const uint8_t *frame, size_t len, uint8_t *out) {
+    uint32_t start = cost_now();
+
+    uint8_t key[FRAME_COMPRESS_KEY_LEN];
+    uint8_t slot = 0;
+    size_t header_len = flow_header(frame, len, key);
+    if (header_len) {
+        slot = flow_slot(self, key);
+    } else {
+        header_len = len < GENERIC_HEADER ? len : GENERIC_HEADER;
+    }
+
+    if (header_len < ETH_HEADER) {
+        out[0] = FORMAT_RAW;
+        memcpy(out + 1, frame, len);
+        record(self, FORMAT_RAW, len, len + 1, cost_now() - start);
+        return len + 1;
+    }
+
+    frame_compress_context_t *context = &self->contexts[slot];
+    size_t bitmap_len = (header_len + 7) / 8;
+    size_t changed = 0;
+    bool delta = context->valid && context->len == header_len && context->deltas < CONFIG_I4A_HEADER_COMPRESSION_REFRESH;
+    if (delta) {
+        for (size_t i = 0; i < header_len; i++) {
+            changed += frame[i] != context->header[i];
+        }
+        // A FULL costs a byte more than the header, it also resynchronizes the context
+        delta = bitmap_len + changed < header_len;
+    }
+
+    size_t out_len;
+    uint8_t format;
+    if (delta) {
+        format = FORMAT_DELTA;
+        out[0] = FORMAT_DELTA;
+        out[1] = slot;
+        out[2] = ++context->gen;
+
+        uint8_t *bitmap = out + 3;
+        uint8_t *p = bitmap + bitmap_len;
+        memset(bitmap, 0, bitmap_len);
+        for (size_t i = 0; i < header_len; i++) {
+            if (frame[i] != context->header[i]) {
+                bitmap[i / 8] |= 1 << (i % 8);
+                *p++ = frame[i];
+            }
+        }
+        memcpy(p, frame + header_len, len - header_len);
+        out_len = (p - out) + len - header_len;
+        context->deltas++;
+    } else {
+        format = FORMAT_FULL;
+        out[0] = FORMAT_FULL;
+        out[1] = slot;
+        out[2] = ++context->gen;
+        out[3] = header_len;
+        memcpy(out + 4, frame, len);
+        out_len = len + 4;
+        context->valid = true;
+        context->len = header_len;
+        context->deltas = 0;
+    }
+    memcpy(context->header, frame, header_len);
+
+    record(self, format, len, out_len, cost_now() - start);
+    return out_len;
+}
+
+size_t frame_compress_decode(frame_compress_t *self, const uint8_t *in, size_t len, uint8_t *frame, size_t frame_sz) {
+    uint32_t start = cost_now();
+    const uint8_t *end = in + len;
+
+    if (len < 1) {
+        return decode_error(self);
+    }
+
+    size_t frame_len;
+    if (in[0] == FORMAT_RAW) {
+        frame_len = len - 1;
+        if (frame_len > frame_sz) {
+            return decode_error(self);
+        }
+        memcpy(frame, in + 1, frame_len);
+        record(self, FORMAT_RAW, frame_len, len, cost_now() - start);
+        return frame_len;
+    }
+
+    if (len < 3 || in[1] >= FRAME_COMPRESS_CONTEXTS) {
+        return decode_error(self);
+    }
+    frame_compress_context_t *context = &self->contexts[in[1]];
+
+    if (in[0] == FORMAT_FULL) {
+        frame_len = len - 4;
+        if (len < 4 || in[3] < ETH_HEADER || in[3] > FRAME_COMPRESS_MAX_HEADER || in[3] > frame_len || frame_len > frame_sz) {
+            return decode_error(self);
+        }
+        memcpy(frame, in + 4, frame_len);
+        context->valid = true;
+        context->gen = in[2];
+        context->len = in[3];
+        memcpy(context->header, frame, context->len);
+        record(self, FORMAT_FULL, frame_len, len, cost_now() - start);
+        return frame_len;
+    }
+
+    if (in[0] != FORMAT_DELTA || !context->valid || in[2] != (uint8_t)(context->gen + 1)) {
+        // Lost track of the flow, wait for its next FULL
+        context->valid = false;
+        return decode_error(self);
+    }
+
+    const uint8_t *bitmap = in + 3;
+    const uint8_t *p = bitmap + (context->len + 7) / 8;
+    if (p > end) {
+        context->valid = false;
+        return decode_error(self);
+    }
+
+    for (size_t i = 0; i < context->len; i++) {
+        if (bitmap[i / 8] & (1 << (i % 8))) {
+            if (p >= end) {
+                context->valid = false;
+                return decode_error(self);
+            }
+            context->header[i] = *p++;
+        }
+    }
+
+    frame_len = context->len + (end - p);
+    if (frame_len > frame_sz) {
+        context->valid = false;
+        return decode_error(self);
+    }
+    memcpy(frame, context->header, context->len);
+    memcpy(frame + context->len, p, end - p);
+    context->gen = in[2];
+
+    record(self, FORMAT_DELTA, frame_len, len, cost_now() - start);
+    return frame_len;
+}
+
+void frame_compress_get_stats(frame_compress_t *self, frame_compress_stats_t *stats) {
+    portENTER_CRITICAL(&self->lock);
+    *stats = self->stats;
+    portEXIT_CRITICAL(&self->lock);
+}
+
+void frame_compress_reset_stats(frame_compress_t *self) {
+    portENTER_CRITICAL(&self->lock);
+    self->stats = (frame_compress_stats_t){ 0 };
+    portEXIT_CRITICAL(&self->lock);
+}
+
+#endif // CONFIG_I4A_HEADER_COMPRESSION
@@ -0,0 +1,81 @@
+#ifndef _FRAME_COMPRESS_H_
+#define _FRAME_COMPRESS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+
+// Header compression of the frames crossing the pysim link, see LINK_OPT_HEADER_COMPRESSION.
+//
+// Every encoded frame starts with its format:
+//  - RAW   (0x00): the frame follows as is
+//  - FULL  (0x01): slot, generation, header length, then the whole frame. The receiver
+//                  stores the first `header length` bytes as the context of the slot
+//  - DELTA (0x02): slot, generation, a bitmap with one bit per header byte of the context
+//                  (LSB first), the header bytes whose bit is set, then the rest of the frame
+//
+// Slot 0 holds the last frame that is not IPv4 TCP/UDP (ARP, IPv6...), the others one
+// flow each. A DELTA is only applied if its generation follows the one of the context,
+// so frames lost on the link cost the frames of their flow up to its next FULL.
+
+#define FRAME_COMPRESS_CONTEXTS   16
+#define FRAME_COMPRESS_MAX_HEADER 96
+#define FRAME_COMPRESS_OVERHEAD   4   // Worst case growth of an encoded frame
+#define FRAME_COMPRESS_KEY_LEN    25  // MAC pair, IPv4 pair, protocol and ports
+
+typedef struct {
+    uint32_t frames;
+    uint32_t full_headers;
+    uint32_t delta_headers;
+    uint32_t raw_frames;
+    uint32_t errors;        // Frames dropped by the decoder
+    uint64_t frame_bytes;   // Before encoding / after decoding
+    uint64_t link_bytes;
+    uint64_t cost_total;    // CPU cycles spent encoding or decoding, nanoseconds on the linux target
+    uint32_t cost_max;
+} frame_compress_stats_t;
+
+typedef struct {
+    bool valid;
+    uint8_t gen;
+    uint8_t len;
+    uint16_t deltas;    // Deltas sent since the last FULL, encoder only
+    uint8_t key[FRAME_COMPRESS_KEY_LEN];
+    uint8_t header[FRAME_COMPRESS_MAX_HEADER];
+} frame_compress_context_t;
+
+// One direction of one interface. Must only be used by one task at a time,
+// except for frame_compress_get_stats.
+typedef struct {
+    bool active;
+    uint8_t next_slot;  // Next flow slot to recycle
+    frame_compress_context_t contexts[FRAME_COMPRESS_CONTEXTS];
+
+    portMUX_TYPE lock;  // Guards `stats`
+    frame_compress_stats_t stats;
+} frame_compress_t;
+
+void frame_compress_init(frame_compress_t *self);
+
+// Forgets every context, so the encoder sends FULL headers again.
+void frame_compress_reset(frame_compress_t *self);
+
+// Tracks whether the link compresses frames, resetting the contexts whenever it
+// is switched on. Returns `active`.
+bool frame_compress_set_active(frame_compress_t *self, bool active);
+
+// Encodes `frame` into `out`, which must hold len + FRAME_COMPRESS_OVERHEAD bytes.
+// Returns the encoded length.
+size_t frame_compress_encode(frame_compress_t *self, const uint8_t *frame, size_t len, uint8_t *out);
+
+// Decodes `len` bytes of `in` into `frame`, of `frame_sz` bytes.
+//
+// Returns the frame length, or 0 if the frame is malformed, too big or its context was lost.
+size_t frame_compress_decode(frame_compress_t *self, const uint8_t *in, size_t len, uint8_t *frame, size_t frame_sz);
+
+void frame_compress_get_stats(frame_compress_t *self, frame_compress_stats_t *stats);
+void frame_compress_reset_stats(frame_compress_t *self);
+
+#endif // _FRAME_COMPRESS_H_
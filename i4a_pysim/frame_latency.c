@@ -0,0 +1,53 @@
+#include <string.h>
+
+#include "frame_latency.h"
+#include "freertos/FreeRTOS.h"
+
+static struct {
+    bool enabled;
+    int64_t sim_offset_us;
+
+    portMUX_TYPE lock;
+    ps_histogram_t stages[PS_LATENCY_MAX];
+} latency = { .lock = portMUX_INITIALIZER_UNLOCKED };
+
+bool frame_latency_enabled(void) {
+    return latency.enabled;
+}
+
+void frame_latency_set_enabled(bool enabled, int64_t sim_offset_us) {
+    portENTER_CRITICAL(&latency.lock);
+    latency.sim_offset_us = sim_offset_us;
+    latency.enabled = enabled;
+    portEXIT_CRITICAL(&latency.lock);
+}
+
+int64_t frame_latency_from_sim(uint64_t sim_timestamp_us) {
+    return (int64_t)sim_timestamp_us + latency.sim_offset_us;
+}
+
+void frame_latency_record(ps_latency_stage_t stage, int64_t from_us, int64_t to_us) {
+    if (!latency.enabled || stage >= PS_LATENCY_MAX) {
+        return;
+    }
+
+    // Clock offset estimation may place simulator timestamps slightly in the future
+    int64_t elapsed = to_us - from_us;
+    uint32_t us = elapsed < 0 ? 0 : (elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed);
+
+    portENTER_CRITICAL(&latency.lock);
+    ps_histogram_record(&latency.stages[stage], us);
+    portEXIT_CRITICAL(&latency.lock);
+}
+
+void frame_latency_get(ps_latency_stage_t stage, ps_histogram_t *histogram) {
+    portENTER_CRITICAL(&latency.lock);
+    *histogram = latency.stages[stage];
+    portEXIT_CRITICAL(&latency.lock);
+}
+
+void frame_latency_reset(void) {
+    portENTER_CRITICAL(&latency.lock);
+    memset(latency.stages, 0, sizeof(latency.stages));
+    portEXIT_CRITICAL(&latency.lock);
+}
@@ -0,0 +1,25 @@
+#ifndef _FRAME_LATENCY_H_
+#define _FRAME_LATENCY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "i4a_pysim.h"
+
+// Aggregates per-stage frame latencies, see ps_latency_stage_t.
+
+bool frame_latency_enabled(void);
+
+// `sim_offset_us` converts simulator timestamps to the local esp_timer clock
+void frame_latency_set_enabled(bool enabled, int64_t sim_offset_us);
+
+// Converts a simulator timestamp to the local clock
+int64_t frame_latency_from_sim(uint64_t sim_timestamp_us);
+
+// Records the time elapsed between `from_us` and `to_us`. Ignored if tracking is disabled.
+void frame_latency_record(ps_latency_stage_t stage, int64_t from_us, int64_t to_us);
+
+void frame_latency_get(ps_latency_stage_t stage, ps_histogram_t *histogram);
+void frame_latency_reset(void);
+
+#endif // _FRAME_LATENCY_H_
@@ -0,0 +1,6 @@
+#include "esp_event.h"
+#include "esp_wifi.h"
+
+// esp_wifi is not built for the Linux host target, only its headers are available.
+// These are the few symbols i4a_pysim needs from it.
+ESP_EVENT_DEFINE_BASE(WIFI_EVENT);
@@ -4,107 +4,649 @@
 #include "esp_random.h"
 #include "esp_netif.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/ringbuf.h"
 #include "virtual_nic.h"
+#include "vnic_bridge.h"
+#include "vnic_pcap.h"
+#include "vnic_shaper.h"
+#include "frame_latency.h"
+#include "frame_compress.h"
+#include "esp_timer.h"
+#include "lwip/netif.h"
 
 
 #define TAG "i4a_pysim"
 
+#define CMD_SET_LINK_OPTIONS 0x18
+#define CMD_PCAP_DATA        0x19
+#define CMD_AP_TX_BATCH      0x1A
+#define CMD_STA_TX_BATCH     0x1B
+#define CMD_WIFI_BATCH       0x1C
+
+#define PCAP_RECORD_MAX (1 + 4 * sizeof(uint32_t) + CONFIG_VNIC_PCAP_MAX_SNAPLEN)
+#define PCAP_CHUNK_SIZE (sizeof(uint16_t) + (PCAP_RECORD_MAX > 1024 ? PCAP_RECORD_MAX : 1024))
+
+#if CONFIG_I4A_NIC_TASK_CORE < 0
+  #define NIC_TASK_CORE tskNO_AFFINITY
+#else
+  #define NIC_TASK_CORE CONFIG_I4A_NIC_TASK_CORE
+#endif
+
+// Options for CMD_SET_LINK_OPTIONS
+#define LINK_OPT_FRAME_TIMESTAMPS (1 << 0)  // WLAN frame events are prefixed by a uint64_t simulator timestamp
+#define LINK_OPT_TX_BATCH         (1 << 1)  // Simulator accepts CMD_*_TX_BATCH: frames prefixed by their uint16_t length
+#define LINK_OPT_CHECKSUM_OFFLOAD (1 << 2)  // Simulator fills in checksums of sent frames and only delivers frames with valid ones
+#define LINK_OPT_HEADER_COMPRESSION (1 << 3)  // WLAN frames are encoded by frame_compress in both directions
+#define LINK_OPT_WIFI_BATCH       (1 << 4)  // Simulator accepts CMD_WIFI_BATCH, see ps_wifi_txn_commit
+#define LINK_OPT_FRAME_FLAGS      (1 << 5)  // WLAN frames arrive as EVT_*_RX_FRAMED, which describe their own framing
+
+// WLAN frame events. The legacy ones carry the bare frame, the framed ones start with FRAME_FLAG_*
+// so that switching timestamps or compression never misreads the frames already in flight.
+#define EVT_WLAN_AP_RX         0x06
+#define EVT_WLAN_STA_RX        0x07
+#define EVT_WLAN_AP_RX_FRAMED  0x08
+#define EVT_WLAN_STA_RX_FRAMED 0x09
+
+#define FRAME_FLAG_TIMESTAMP      (1 << 0)  // A uint64_t simulator timestamp precedes the frame
+#define FRAME_FLAG_COMPRESSED     (1 << 1)  // The frame is encoded by frame_compress
+#define FRAME_FLAG_COMPRESS_RESET (1 << 2)  // The simulator reset its encoder before encoding the frame
+
+// Checksums handed to the simulator by LINK_OPT_CHECKSUM_OFFLOAD
+#define CHECKSUM_OFFLOAD_FLAGS (NETIF_CHECKSUM_GEN_IP | NETIF_CHECKSUM_GEN_UDP | NETIF_CHECKSUM_GEN_TCP | NETIF_CHECKSUM_GEN_ICMP | \
+                                NETIF_CHECKSUM_CHECK_IP | NETIF_CHECKSUM_CHECK_UDP | NETIF_CHECKSUM_CHECK_TCP | NETIF_CHECKSUM_CHECK_ICMP)
+
+// Frames aggregated into a single CMD_*_TX_BATCH
+#define TX_BATCH_MAX_FRAMES 16
+
+// Most a frame takes in a batch: its length, then the frame grown by its encoding
+#define TX_FRAME_SLOT_SIZE (sizeof(uint16_t) + VNIC_MAX_LEN + FRAME_COMPRESS_OVERHEAD)
+// The first frame is taken before knowing whether it will be batched, so it must fit even if
+// PS_MAX_PAYLOAD_SIZE is smaller. The frames added after it keep within PS_MAX_PAYLOAD_SIZE.
+#define TX_BATCH_SIZE (PS_MAX_PAYLOAD_SIZE > TX_FRAME_SLOT_SIZE ? PS_MAX_PAYLOAD_SIZE : TX_FRAME_SLOT_SIZE)
+
+// Every op of a CMD_WIFI_BATCH is its command and uint16_t length, followed by its arguments
+#define WIFI_OP_HEADER (sizeof(uint8_t) + sizeof(uint16_t))
+
+#if CONFIG_I4A_RX_PIPELINES
+  #if CONFIG_I4A_RX_PIPELINE_AP_CORE < 0
+    #define RX_PIPELINE_AP_CORE tskNO_AFFINITY
+  #else
+    #define RX_PIPELINE_AP_CORE CONFIG_I4A_RX_PIPELINE_AP_CORE
+  #endif
+  #if CONFIG_I4A_RX_PIPELINE_STA_CORE < 0
+    #define RX_PIPELINE_STA_CORE tskNO_AFFINITY
+  #else
+    #define RX_PIPELINE_STA_CORE CONFIG_I4A_RX_PIPELINE_STA_CORE
+  #endif
+#endif
+
+#if CONFIG_I4A_PCAP_TASK_CORE < 0
+  #define PCAP_TASK_CORE tskNO_AFFINITY
+#else
+  #define PCAP_TASK_CORE CONFIG_I4A_PCAP_TASK_CORE
+#endif
+
+#if CONFIG_I4A_SPI_ENQUEUE_WAIT_MS < 0
+  #define SPI_ENQUEUE_WAIT portMAX_DELAY
+#else
+  #define SPI_ENQUEUE_WAIT pdMS_TO_TICKS(CONFIG_I4A_SPI_ENQUEUE_WAIT_MS)
+#endif
+
+#if CONFIG_I4A_VNIC_TX_TIMEOUT_MS < 0
+  #define VNIC_TX_TIMEOUT portMAX_DELAY
+#else
+  #define VNIC_TX_TIMEOUT pdMS_TO_TICKS(CONFIG_I4A_VNIC_TX_TIMEOUT_MS)
+#endif
+
+// Item of the SPI ring, its length is the one of the item
 typedef struct {
-    size_t len;
-    uint8_t data[1600];
+    int64_t queued_us;
+    uint8_t data[];
 } spi_packet_t;
 
+// Frame event once its framing is parsed by wlan_rx_parse
+typedef struct {
+    uint8_t flags;          // FRAME_FLAG_*
+    vnic_meta_t meta;       // origin_us is set if the latency of the frame is recorded
+    const uint8_t *frame;   // Still encoded if FRAME_FLAG_COMPRESSED
+    size_t len;
+} rx_frame_t;
+
+#if CONFIG_I4A_RX_PIPELINES
+typedef struct {
+    rx_frame_t frame;   // Points to `data`
+    uint8_t data[CONFIG_PYSIM_EVENT_BUFFER_SIZE];
+} rx_buffer_t;
+
+// Receive path of one interface, see CONFIG_I4A_RX_PIPELINES
+typedef struct {
+    vnic_t *rx;
+    size_t port;
+    QueueHandle_t queue;    // Buffers filled by the polling task, in arrival order
+    QueueHandle_t free;     // Buffers the polling task can fill
+    rx_buffer_t *buffers;
+    bool running;           // Whether its task was created
+
+    portMUX_TYPE lock;
+    ps_rx_pipeline_stats_t stats;
+} rx_pipeline_t;
+#endif
+
+// Arguments of the set config commands
+typedef union {
+    struct {
+        char ssid[32];
+        char password[64];
+        uint32_t channel;
+    } ap;
+    struct {
+        char ssid[32];
+        char password[64];
+    } sta;
+} wifi_config_payload_t;
+
+_Static_assert(WIFI_OP_HEADER + sizeof(wifi_config_payload_t) <= PS_WIFI_TXN_BATCH_SIZE / PS_WIFI_TXN_MAX_OPS,
+               "PS_WIFI_TXN_BATCH_SIZE must hold PS_WIFI_TXN_MAX_OPS set config ops");
+_Static_assert(PS_WIFI_TXN_BATCH_SIZE <= PS_MAX_PAYLOAD_SIZE, "CMD_WIFI_BATCH must fit in a single command");
+
+typedef struct {
+    vnic_t *rx;
+    uint8_t command, batch_command;
+    uint8_t batch[TX_BATCH_SIZE];
+    vnic_meta_t metas[TX_BATCH_MAX_FRAMES];
+    int64_t dequeued_us[TX_BATCH_MAX_FRAMES];
+#if CONFIG_I4A_HEADER_COMPRESSION
+    frame_compress_t *compress;
+    uint8_t frame[VNIC_MAX_LEN];
+#endif
+} nic_tx_t;
+
 static struct {
     bool initialized;
+    uint32_t link_options;  // LINK_OPT_* accepted by the simulator
 
-    StaticSemaphore_t _st_spi_queue;
-    QueueHandle_t spi_queue;
+    struct {
+        RingbufHandle_t ring;
+        StaticRingbuffer_t _st_ring;
+        SemaphoreHandle_t consumer;     // Held by ps_spi_recv* while taking packets
+        spi_packet_t *pending;          // Taken from the ring but left for the next call
+        size_t pending_len;
+
+        portMUX_TYPE lock;              // Guards the fields below
+        uint32_t waiting_packets, waiting_bytes;
+        ps_spi_stats_t stats;
+    } spi;
 
     struct {
         vnic_t ap_tx, ap_rx;
         vnic_t sta_tx, sta_rx;
         esp_netif_t *ap_netif, *sta_netif;
         wifi_mode_t mode;
+        SemaphoreHandle_t event_lock;   // Held while a transaction posts its events, see ps_wifi_txn_commit
+
+        vnic_bridge_t bridge;
+        size_t ap_port, sta_port;
     } wlan;
+
+#if CONFIG_I4A_HEADER_COMPRESSION
+    struct {
+        frame_compress_t ap_tx, ap_rx;
+        frame_compress_t sta_tx, sta_rx;
+        // Decoded frame events, one buffer per interface since RX pipelines decode in parallel
+        uint8_t ap_frame[VNIC_MAX_LEN], sta_frame[VNIC_MAX_LEN];
+    } compress;
+#endif
+
+#if CONFIG_I4A_RX_PIPELINES
+    struct {
+        rx_pipeline_t ap, sta;
+    } rx;
+#endif
+
+    struct {
+        TaskHandle_t task;
+        uint16_t snaplen;
+        uint32_t streamed;
+        uint32_t stream_bytes;
+        uint32_t stream_errors;
+    } pcap;
 } hal = { 0 };
 
 static void event_spi_rx(uint8_t event_id, const void *event_data, size_t sz_event_data) {
-    spi_packet_t* buffer = calloc(1, sizeof(spi_packet_t));
-    buffer->len = sz_event_data;
-    memcpy(buffer->data, event_data, sz_event_data);
-    xQueueSend(hal.spi_queue, &buffer, portMAX_DELAY);
+    size_t sz_item = sizeof(spi_packet_t) + sz_event_data;
+    if (sz_item > xRingbufferGetMaxItemSize(hal.spi.ring)) {
+        portENTER_CRITICAL(&hal.spi.lock);
+        hal.spi.stats.drop_no_memory++;
+        portEXIT_CRITICAL(&hal.spi.lock);
+        return;
+    }
+
+    // Waiting here stalls every other event, so a consumer that falls behind loses packets instead
+    spi_packet_t *packet = NULL;
+    if (xRingbufferSendAcquire(hal.spi.ring, (void **)&packet, sz_item, SPI_ENQUEUE_WAIT) != pdTRUE) {
+        portENTER_CRITICAL(&hal.spi.lock);
+        hal.spi.stats.drop_queue_full++;
+        portEXIT_CRITICAL(&hal.spi.lock);
+        return;
+    }
+    packet->queued_us = esp_timer_get_time();
+    memcpy(packet->data, event_data, sz_event_data);
+
+    // Counted before the packet can be taken, so waiting_* never goes below zero
+    portENTER_CRITICAL(&hal.spi.lock);
+    hal.spi.stats.queued_packets++;
+    hal.spi.stats.queued_bytes += sz_event_data;
+    hal.spi.waiting_packets++;
+    hal.spi.waiting_bytes += sz_item;
+    if (hal.spi.waiting_packets > hal.spi.stats.queue_high_water) {
+        hal.spi.stats.queue_high_water = hal.spi.waiting_packets;
+    }
+    if (hal.spi.waiting_bytes > hal.spi.stats.ring_high_water) {
+        hal.spi.stats.ring_high_water = hal.spi.waiting_bytes;
+    }
+    portEXIT_CRITICAL(&hal.spi.lock);
+    xRingbufferSendComplete(hal.spi.ring, packet);
+}
+
+// Posts a Wi-Fi event sent by the simulator once any transaction in flight posted its own
+static void post_wifi_event(int32_t event) {
+    xSemaphoreTake(hal.wlan.event_lock, portMAX_DELAY);
+    if (event == WIFI_EVENT_STA_CONNECTED) {
+        esp_netif_action_connected(
+            esp_netif_get_handle_from_ifkey("WIFI_STA_DEF"),
+            WIFI_EVENT,
+            WIFI_EVENT_STA_CONNECTED,
+            NULL
+        );
+    }
+    esp_event_post(WIFI_EVENT, event, NULL, 0, portMAX_DELAY);
+    xSemaphoreGive(hal.wlan.event_lock);
 }
 
 static void event_sta_arrived(uint8_t event_id, const void *event_data, size_t sz_event_data) {
-    esp_event_post(WIFI_EVENT, WIFI_EVENT_AP_STACONNECTED, NULL, 0, portMAX_DELAY);
+    post_wifi_event(WIFI_EVENT_AP_STACONNECTED);
 }
 
 static void event_sta_left(uint8_t event_id, const void *event_data, size_t sz_event_data) {
-    esp_event_post(WIFI_EVENT, WIFI_EVENT_AP_STADISCONNECTED, NULL, 0, portMAX_DELAY);
+    post_wifi_event(WIFI_EVENT_AP_STADISCONNECTED);
 }
 
 static void event_connected_to_ap(uint8_t event_id, const void *event_data, size_t sz_event_data) {
-    esp_netif_action_connected(
-        esp_netif_get_handle_from_ifkey("WIFI_STA_DEF"),
-        WIFI_EVENT,
-        WIFI_EVENT_STA_CONNECTED,
-        NULL
-    );
-    esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, NULL, 0, portMAX_DELAY);
+    post_wifi_event(WIFI_EVENT_STA_CONNECTED);
 }
 
 static void event_connection_to_ap_lost(uint8_t event_id, const void *event_data, size_t sz_event_data) {
-    esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, NULL, 0, portMAX_DELAY);
+    post_wifi_event(WIFI_EVENT_STA_DISCONNECTED);
+}
+
+// Undoes the header compression of a frame event. Returns NULL if the frame must be dropped.
+static const uint8_t *wlan_rx_decode(vnic_t *rx, uint8_t flags, const uint8_t *frame, size_t *len) {
+    if (!(flags & FRAME_FLAG_COMPRESSED)) {
+        return frame;
+    }
+
+#if CONFIG_I4A_HEADER_COMPRESSION
+    bool ap = rx == &hal.wlan.ap_rx;
+    frame_compress_t *compress = ap ? &hal.compress.ap_rx : &hal.compress.sta_rx;
+    uint8_t *decoded = ap ? hal.compress.ap_frame : hal.compress.sta_frame;
+    if (flags & FRAME_FLAG_COMPRESS_RESET) {
+        frame_compress_reset(compress);
+    }
+    *len = frame_compress_decode(compress, frame, *len, decoded, VNIC_MAX_LEN);
+    return *len ? decoded : NULL;
+#else
+    return NULL;
+#endif
 }
 
+// Parses the framing of an event read from the link at `link_us`. Only framed events
+// (LINK_OPT_FRAME_FLAGS) may carry a timestamp or a compressed frame. Whether the latency
+// of the frame is recorded is decided here, as it is read. Returns false if it must be dropped.
+static bool wlan_rx_parse(bool framed, const uint8_t *data, size_t len, int64_t link_us, rx_frame_t *rx_frame) {
+    *rx_frame = (rx_frame_t){ 0 };
+    if (framed) {
+        if (len < sizeof(rx_frame->flags)) {
+            ESP_LOGE(TAG, "empty frame event");
+            return false;
+        }
+        rx_frame->flags = data[0];
+        data += sizeof(rx_frame->flags);
+        len -= sizeof(rx_frame->flags);
+    }
+
+    if (rx_frame->flags & FRAME_FLAG_TIMESTAMP) {
+        if (len < sizeof(uint64_t)) {
+            ESP_LOGE(TAG, "frame event without timestamp");
+            return false;
+        }
+
+        uint64_t sim_timestamp;
+        memcpy(&sim_timestamp, data, sizeof(sim_timestamp));
+        data += sizeof(uint64_t);
+        len -= sizeof(uint64_t);
+
+        // Frames timestamped before tracking was switched off are still stripped, just not recorded
+        if (frame_latency_enabled()) {
+            rx_frame->meta.link_us = link_us;
+            rx_frame->meta.origin_us = frame_latency_from_sim(sim_timestamp);
+            frame_latency_record(PS_LATENCY_RX_SIM_TO_LINK, rx_frame->meta.origin_us, link_us);
+        }
+    }
+
+    rx_frame->frame = data;
+    rx_frame->len = len;
+    return true;
+}
+
+// Hands a parsed frame event to lwIP and the bridge
+static void wlan_rx(vnic_t *rx, size_t port, const rx_frame_t *rx_frame) {
+    size_t len = rx_frame->len;
+    const uint8_t *frame = wlan_rx_decode(rx, rx_frame->flags, rx_frame->frame, &len);
+    if (!frame) {
+        return;
+    }
+
+    vnic_bridge_verdict_t verdict = vnic_bridge_input(&hal.wlan.bridge, port, frame, len);
+    if ((verdict != VNIC_BRIDGE_LOCAL) && (verdict != VNIC_BRIDGE_BOTH)) {
+        return;
+    }
+
+    const vnic_meta_t *meta = &rx_frame->meta;
+    if (vnic_transmit_meta(rx, frame, len, meta->origin_us ? meta : NULL) != VNIC_OK) {
+        ESP_LOGE(TAG, "%s vnic transmit failed", rx == &hal.wlan.ap_rx ? "ap" : "sta");
+        return;
+    }
+
+    if (meta->origin_us) {
+        frame_latency_record(PS_LATENCY_RX_LINK_TO_VNIC, meta->link_us, esp_timer_get_time());
+    }
+}
+
+#if CONFIG_I4A_RX_PIPELINES
+
+static void rx_pipeline_task(void *arg) {
+    rx_pipeline_t *pipeline = arg;
+
+    while (true) {
+        rx_buffer_t *buffer;
+        if (xQueueReceive(pipeline->queue, &buffer, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        wlan_rx(pipeline->rx, pipeline->port, &buffer->frame);
+        xQueueSend(pipeline->free, &buffer, 0);
+
+        portENTER_CRITICAL(&pipeline->lock);
+        pipeline->stats.processed++;
+        portEXIT_CRITICAL(&pipeline->lock);
+    }
+}
+
+// Without its task, the frames of the pipeline are processed by the polling task as they are read
+static void rx_pipeline_create(rx_pipeline_t *pipeline, const char *name, vnic_t *rx, size_t port, BaseType_t core) {
+    pipeline->rx = rx;
+    pipeline->port = port;
+    portMUX_INITIALIZE(&pipeline->lock);
+
+    pipeline->queue = xQueueCreate(CONFIG_I4A_RX_PIPELINE_BUFFERS, sizeof(rx_buffer_t *));
+    pipeline->free = xQueueCreate(CONFIG_I4A_RX_PIPELINE_BUFFERS, sizeof(rx_buffer_t *));
+    pipeline->buffers = malloc(CONFIG_I4A_RX_PIPELINE_BUFFERS * sizeof(rx_buffer_t));
+    assert(pipeline->queue && pipeline->free && pipeline->buffers);
+    ps_mem_add_static(PS_MEM_VNIC, CONFIG_I4A_RX_PIPELINE_BUFFERS * (sizeof(rx_buffer_t) + 2 * sizeof(rx_buffer_t *)));
+
+    for (size_t i = 0; i < CONFIG_I4A_RX_PIPELINE_BUFFERS; i++) {
+        rx_buffer_t *buffer = &pipeline->buffers[i];
+        xQueueSend(pipeline->free, &buffer, 0);
+    }
+
+    TaskHandle_t task = NULL;
+    if (xTaskCreatePinnedToCore(rx_pipeline_task, name, CONFIG_I4A_RX_PIPELINE_STACK_SIZE, pipeline,
+                                CONFIG_I4A_RX_PIPELINE_PRIORITY, &task, core) != pdPASS) {
+        ESP_LOGE(TAG, "could not create %s, its frames are processed by the polling task", name);
+        return;
+    }
+    pipeline->running = true;
+    ps_mem_register_task(PS_MEM_VNIC, task, CONFIG_I4A_RX_PIPELINE_STACK_SIZE);
+}
+
+// Copies a parsed frame event into a buffer of `pipeline`, leaving the rest of the receive path to its task
+static void rx_pipeline_push(rx_pipeline_t *pipeline, const rx_frame_t *rx_frame) {
+    if (!pipeline->running) {
+        wlan_rx(pipeline->rx, pipeline->port, rx_frame);
+        return;
+    }
+
+    // Events never exceed the event buffer, so every one fits
+    rx_buffer_t *buffer;
+    bool waited = false;
+    if (xQueueReceive(pipeline->free, &buffer, 0) != pdTRUE) {
+        waited = true;
+        while (xQueueReceive(pipeline->free, &buffer, portMAX_DELAY) != pdTRUE) ;
+    }
+
+    buffer->frame = *rx_frame;
+    buffer->frame.frame = buffer->data;
+    memcpy(buffer->data, rx_frame->frame, rx_frame->len);
+    xQueueSend(pipeline->queue, &buffer, portMAX_DELAY);
+
+    UBaseType_t in_use = CONFIG_I4A_RX_PIPELINE_BUFFERS - uxQueueMessagesWaiting(pipeline->free);
+    portENTER_CRITICAL(&pipeline->lock);
+    pipeline->stats.queued++;
+    pipeline->stats.waited += waited;
+    if (in_use > pipeline->stats.buffers_high_water) {
+        pipeline->stats.buffers_high_water = in_use;
+    }
+    portEXIT_CRITICAL(&pipeline->lock);
+}
+
+#endif // CONFIG_I4A_RX_PIPELINES
+
 static void event_wlan_ap_rx(uint8_t event_id, const void *event_data, size_t sz_event_data) {
-    if (vnic_transmit(&hal.wlan.ap_rx, event_data, sz_event_data) != VNIC_OK) {
-        ESP_LOGE(TAG, "sta vnic transmit failed");
+    rx_frame_t rx_frame;
+    if (!wlan_rx_parse(event_id == EVT_WLAN_AP_RX_FRAMED, event_data, sz_event_data, esp_timer_get_time(), &rx_frame)) {
+        return;
     }
+#if CONFIG_I4A_RX_PIPELINES
+    rx_pipeline_push(&hal.rx.ap, &rx_frame);
+#else
+    wlan_rx(&hal.wlan.ap_rx, hal.wlan.ap_port, &rx_frame);
+#endif
 }
 
 static void event_wlan_sta_rx(uint8_t event_id, const void *event_data, size_t sz_event_data) {
-    if (vnic_transmit(&hal.wlan.sta_rx, event_data, sz_event_data) != VNIC_OK) {
-        ESP_LOGE(TAG, "sta vnic transmit failed");
+    rx_frame_t rx_frame;
+    if (!wlan_rx_parse(event_id == EVT_WLAN_STA_RX_FRAMED, event_data, sz_event_data, esp_timer_get_time(), &rx_frame)) {
+        return;
     }
+#if CONFIG_I4A_RX_PIPELINES
+    rx_pipeline_push(&hal.rx.sta, &rx_frame);
+#else
+    wlan_rx(&hal.wlan.sta_rx, hal.wlan.sta_port, &rx_frame);
+#endif
 }
 
-static void nic_task_sta()
-{
-    static uint8_t buffer[1600];
-    size_t recvd = 0;
+// Requests `options` and stores the subset the simulator accepted in hal.link_options.
+//
+// The simulator answers with its clock (uint64_t) and, if it knows options other than
+// LINK_OPT_FRAME_TIMESTAMPS, the accepted options (uint32_t). `offset` receives the
+// difference between our clock and the simulator's, assuming it was sampled halfway
+// through the round trip.
+static esp_err_t set_link_options(uint32_t options, int64_t *offset) {
+    struct __attribute__((packed)) {
+        uint64_t sim_now;
+        uint32_t accepted;
+    } response = { 0 };
+    size_t sz_response = sizeof(response);
+
+    int64_t t_start = esp_timer_get_time();
+    uint8_t ret = ps_execute(CMD_SET_LINK_OPTIONS, &options, sizeof(options), &response, &sz_response);
+    int64_t t_end = esp_timer_get_time();
+
+    if (ret != 0 || sz_response < sizeof(response.sim_now)) {
+        ESP_LOGE(TAG, "simulator rejected link options 0x%08" PRIx32 ": %u", options, ret);
+        return ESP_FAIL;
+    }
 
-    while (true)
+    if (sz_response < sizeof(response)) {
+        response.accepted = options & LINK_OPT_FRAME_TIMESTAMPS;
+    }
+    hal.link_options = response.accepted & options;
+
+    if (offset) {
+        *offset = (t_start + (t_end - t_start) / 2) - (int64_t)response.sim_now;
+    }
+    return ESP_OK;
+}
+
+// Sends a frame dequeued from `rx` to the simulator, accounting its latency if it carries timestamps.
+// Returns the status of the command.
+static uint8_t wlan_tx(uint8_t command, const uint8_t *frame, size_t len, const vnic_meta_t *meta) {
+    if (!meta->origin_us) {
+        return ps_execute(command, frame, len, NULL, NULL);
+    }
+
+    int64_t dequeued_us = esp_timer_get_time();
+    uint8_t ret = ps_execute(command, frame, len, NULL, NULL);
+    int64_t done_us = esp_timer_get_time();
+
+    frame_latency_record(PS_LATENCY_TX_VNIC_QUEUE, meta->queued_us, dequeued_us);
+    frame_latency_record(PS_LATENCY_TX_LINK, dequeued_us, done_us);
+    frame_latency_record(PS_LATENCY_TX_TOTAL, meta->origin_us, done_us);
+    return ret;
+}
+
+// Takes the next frame of `tx->rx` into the batch, after its uint16_t length at `used`.
+// `len` receives the bytes the frame takes on the link, encoded if the simulator
+// accepted LINK_OPT_HEADER_COMPRESSION.
+static vnic_result_t wlan_tx_receive(nic_tx_t *tx, size_t used, size_t *len, vnic_meta_t *meta, TickType_t timeout) {
+    uint8_t *dst = tx->batch + used + sizeof(uint16_t);
+#if CONFIG_I4A_HEADER_COMPRESSION
+    if (frame_compress_set_active(tx->compress, hal.link_options & LINK_OPT_HEADER_COMPRESSION)) {
+        size_t recvd;
+        vnic_result_t err = vnic_receive_timeout(tx->rx, tx->frame, sizeof(tx->frame), &recvd, meta, timeout);
+        if (err == VNIC_OK) {
+            *len = frame_compress_encode(tx->compress, tx->frame, recvd, dst);
+        }
+        return err;
+    }
+#endif
+    return vnic_receive_timeout(tx->rx, dst, VNIC_MAX_LEN, len, meta, timeout);
+}
+
+// The simulator may have missed frames that updated its contexts, start over with FULL headers
+static void wlan_tx_failed(nic_tx_t *tx) {
+#if CONFIG_I4A_HEADER_COMPRESSION
+    frame_compress_reset(tx->compress);
+#endif
+}
+
+// Adds to `batch`, after the frame already in it, every frame queued on `rx` within the
+// flush time of the link profile, up to its batch size. Returns the batch length.
+static size_t wlan_tx_fill_batch(nic_tx_t *tx, size_t used, size_t *n_frames) {
+    ps_link_profile_t profile;
+    ps_link_get_profile(&profile);
+    // Rounded down: a flush time below a tick only takes the frames already queued, waiting
+    // a whole tick would delay every lone frame (ACKs, pings) far longer than the link does
+    TickType_t flush_ticks = pdMS_TO_TICKS(profile.flush_us / 1000);
+
+    while (*n_frames < TX_BATCH_MAX_FRAMES && used < profile.batch_bytes &&
+           used + TX_FRAME_SLOT_SIZE <= PS_MAX_PAYLOAD_SIZE)
     {
-        vnic_result_t verr;
-        if ((verr = vnic_receive(&hal.wlan.sta_rx, buffer, 1600, &recvd)) != VNIC_OK)
+        size_t recvd;
+        if (wlan_tx_receive(tx, used, &recvd, &tx->metas[*n_frames], flush_ticks) != VNIC_OK)
         {
-            ESP_LOGE(TAG, "vnic_receive failed: %u\n", verr);
             break;
         }
 
-        ps_execute(0x14, buffer, recvd, NULL, NULL);
+        tx->dequeued_us[*n_frames] = esp_timer_get_time();
+        uint16_t len = recvd;
+        memcpy(tx->batch + used, &len, sizeof(len));
+        used += sizeof(len) + recvd;
+        (*n_frames)++;
     }
-
-    vTaskDelete(NULL);
+    return used;
 }
 
-static void nic_task_ap()
+// Forwards the frames queued on `tx->rx` to the simulator. If the simulator accepts
+// LINK_OPT_TX_BATCH, frames already waiting are aggregated into a single command.
+static void nic_task_loop(nic_tx_t *tx)
 {
-    static uint8_t buffer[1600];
-    size_t recvd = 0;
-
     while (true)
     {
+        size_t recvd = 0;
         vnic_result_t verr;
-        if ((verr = vnic_receive(&hal.wlan.ap_rx, buffer, 1600, &recvd)) != VNIC_OK)
+        while ((verr = wlan_tx_receive(tx, 0, &recvd, &tx->metas[0], portMAX_DELAY)) == VNIC_TIMEOUT)
+        {
+            // keep waiting until lwIP sends something
+        }
+        if (verr != VNIC_OK)
         {
             ESP_LOGE(TAG, "vnic_receive failed: %u\n", verr);
             break;
         }
 
-        ps_execute(0x17, buffer, recvd, NULL, NULL);
+        size_t n_frames = 1;
+        size_t used = sizeof(uint16_t) + recvd;
+        if (hal.link_options & LINK_OPT_TX_BATCH)
+        {
+            tx->dequeued_us[0] = esp_timer_get_time();
+            used = wlan_tx_fill_batch(tx, used, &n_frames);
+        }
+
+        if (n_frames == 1)
+        {
+            if (wlan_tx(tx->command, tx->batch + sizeof(uint16_t), recvd, &tx->metas[0]) != 0)
+            {
+                wlan_tx_failed(tx);
+            }
+            continue;
+        }
+
+        uint16_t len = recvd;
+        memcpy(tx->batch, &len, sizeof(len));
+        if (ps_execute(tx->batch_command, tx->batch, used, NULL, NULL) != 0)
+        {
+            wlan_tx_failed(tx);
+        }
+
+        int64_t done_us = esp_timer_get_time();
+        for (size_t i = 0; i < n_frames; i++)
+        {
+            if (tx->metas[i].origin_us)
+            {
+                frame_latency_record(PS_LATENCY_TX_VNIC_QUEUE, tx->metas[i].queued_us, tx->dequeued_us[i]);
+                frame_latency_record(PS_LATENCY_TX_LINK, tx->dequeued_us[i], done_us);
+                frame_latency_record(PS_LATENCY_TX_TOTAL, tx->metas[i].origin_us, done_us);
+            }
+        }
     }
+}
+
+static void nic_task_sta()
+{
+    static nic_tx_t tx;
+    tx.rx = &hal.wlan.sta_rx;
+    tx.command = 0x14;
+    tx.batch_command = CMD_STA_TX_BATCH;
+#if CONFIG_I4A_HEADER_COMPRESSION
+    tx.compress = &hal.compress.sta_tx;
+#endif
+    nic_task_loop(&tx);
+
+    vTaskDelete(NULL);
+}
+
+static void nic_task_ap()
+{
+    static nic_tx_t tx;
+    tx.rx = &hal.wlan.ap_rx;
+    tx.command = 0x17;
+    tx.batch_command = CMD_AP_TX_BATCH;
+#if CONFIG_I4A_HEADER_COMPRESSION
+    tx.compress = &hal.compress.ap_tx;
+#endif
+    nic_task_loop(&tx);
 
     vTaskDelete(NULL);
 }
@@ -115,6 +657,11 @@ static esp_err_t _ps_wifi_init() {
     assert(vnic_create(&hal.wlan.sta_tx) == VNIC_OK);
     assert(vnic_create(&hal.wlan.sta_rx) == VNIC_OK);
 
+    vnic_set_tx_timeout(&hal.wlan.ap_tx, VNIC_TX_TIMEOUT);
+    vnic_set_tx_timeout(&hal.wlan.ap_rx, VNIC_TX_TIMEOUT);
+    vnic_set_tx_timeout(&hal.wlan.sta_tx, VNIC_TX_TIMEOUT);
+    vnic_set_tx_timeout(&hal.wlan.sta_rx, VNIC_TX_TIMEOUT);
+
     assert(vnic_bind_receiver(&hal.wlan.ap_tx, &hal.wlan.ap_rx) == VNIC_OK);
     assert(vnic_bind_receiver(&hal.wlan.sta_tx, &hal.wlan.sta_rx) == VNIC_OK);
     assert(vnic_bind_receiver(&hal.wlan.ap_rx, &hal.wlan.ap_tx) == VNIC_OK);
@@ -123,13 +670,43 @@ static esp_err_t _ps_wifi_init() {
     esp_netif_config_t ap_config = ESP_NETIF_DEFAULT_WIFI_AP();
     esp_netif_config_t sta_config = ESP_NETIF_DEFAULT_WIFI_STA();
 
+#if CONFIG_I4A_RX_PIPELINES
+    // lwIP receives each interface on the core of its pipeline
+    assert(vnic_register_esp_netif_on_core(&hal.wlan.ap_tx, ap_config, RX_PIPELINE_AP_CORE) == VNIC_OK);
+    assert(vnic_register_esp_netif_on_core(&hal.wlan.sta_tx, sta_config, RX_PIPELINE_STA_CORE) == VNIC_OK);
+#else
     assert(vnic_register_esp_netif(&hal.wlan.ap_tx, ap_config) == VNIC_OK);
     assert(vnic_register_esp_netif(&hal.wlan.sta_tx, sta_config) == VNIC_OK);
-    xTaskCreate(nic_task_ap, "nic_task_ap", 4096, NULL, tskIDLE_PRIORITY + 1, NULL);
-    xTaskCreate(nic_task_sta, "nic_task_sta", 4096, NULL, tskIDLE_PRIORITY + 1, NULL);
+#endif
+
+#if CONFIG_I4A_HEADER_COMPRESSION
+    frame_compress_init(&hal.compress.ap_tx);
+    frame_compress_init(&hal.compress.ap_rx);
+    frame_compress_init(&hal.compress.sta_tx);
+    frame_compress_init(&hal.compress.sta_rx);
+    ps_mem_add_static(PS_MEM_VNIC, sizeof(hal.compress));
+#endif
+
+    TaskHandle_t ap_task = NULL, sta_task = NULL;
+    xTaskCreatePinnedToCore(nic_task_ap, "nic_task_ap", CONFIG_I4A_NIC_TASK_STACK_SIZE, NULL, CONFIG_I4A_NIC_TASK_PRIORITY, &ap_task, NIC_TASK_CORE);
+    xTaskCreatePinnedToCore(nic_task_sta, "nic_task_sta", CONFIG_I4A_NIC_TASK_STACK_SIZE, NULL, CONFIG_I4A_NIC_TASK_PRIORITY, &sta_task, NIC_TASK_CORE);
+    ps_mem_register_task(PS_MEM_VNIC, ap_task, CONFIG_I4A_NIC_TASK_STACK_SIZE);
+    ps_mem_register_task(PS_MEM_VNIC, sta_task, CONFIG_I4A_NIC_TASK_STACK_SIZE);
+    ps_mem_add_static(PS_MEM_VNIC, 2 * sizeof(nic_tx_t));
 
     uint32_t mac = esp_random();
     uint8_t wl_mac[6] = {0xaa, 0xaa, (mac >> 24) & 0xFF, (mac >> 16) & 0xFF, (mac >> 8) & 0xFF, mac & 0xFF};
+
+    // Frames switched to ap_tx/sta_tx go straight to nic_task_ap/nic_task_sta, skipping lwIP
+    assert(vnic_bridge_create(&hal.wlan.bridge, CONFIG_VNIC_BRIDGE_AGING_MS) == VNIC_OK);
+    assert(vnic_bridge_add_port(&hal.wlan.bridge, &hal.wlan.ap_tx, wl_mac, &hal.wlan.ap_port) == VNIC_OK);
+    assert(vnic_bridge_add_port(&hal.wlan.bridge, &hal.wlan.sta_tx, wl_mac, &hal.wlan.sta_port) == VNIC_OK);
+
+#if CONFIG_I4A_RX_PIPELINES
+    rx_pipeline_create(&hal.rx.ap, "rx_pipeline_ap", &hal.wlan.ap_rx, hal.wlan.ap_port, RX_PIPELINE_AP_CORE);
+    rx_pipeline_create(&hal.rx.sta, "rx_pipeline_sta", &hal.wlan.sta_rx, hal.wlan.sta_port, RX_PIPELINE_STA_CORE);
+#endif
+
     esp_netif_t *ap = ps_netif_create_default_wifi_ap();
     esp_netif_set_mac(ap, wl_mac);
     esp_netif_t *sta = ps_netif_create_default_wifi_sta();
@@ -148,13 +725,59 @@ void i4a_pysim_init() {
     ps_register_event(0x03, event_sta_left);
     ps_register_event(0x04, event_connected_to_ap);
     ps_register_event(0x05, event_connection_to_ap_lost);
-    ps_register_event(0x06, event_wlan_ap_rx);
-    ps_register_event(0x07, event_wlan_sta_rx);
-
-    hal.spi_queue = xQueueCreate(1, sizeof(spi_packet_t*));
+    ps_register_event(EVT_WLAN_AP_RX, event_wlan_ap_rx);
+    ps_register_event(EVT_WLAN_STA_RX, event_wlan_sta_rx);
+    ps_register_event(EVT_WLAN_AP_RX_FRAMED, event_wlan_ap_rx);
+    ps_register_event(EVT_WLAN_STA_RX_FRAMED, event_wlan_sta_rx);
+
+    portMUX_INITIALIZE(&hal.spi.lock);
+    uint8_t *spi_storage = ps_mem_reserve(PS_MEM_SPI, CONFIG_I4A_SPI_RING_SIZE);
+    assert(spi_storage);
+    hal.spi.ring = xRingbufferCreateStatic(CONFIG_I4A_SPI_RING_SIZE, RINGBUF_TYPE_NOSPLIT, spi_storage, &hal.spi._st_ring);
+    hal.spi.consumer = xSemaphoreCreateMutex();
+    assert(hal.spi.ring && hal.spi.consumer);
+    if (xRingbufferGetMaxItemSize(hal.spi.ring) < sizeof(spi_packet_t) + CONFIG_PYSIM_EVENT_BUFFER_SIZE) {
+        ESP_LOGW(TAG, "CONFIG_I4A_SPI_RING_SIZE is too small for the largest SPI packets, they will be dropped");
+    }
+    hal.wlan.event_lock = xSemaphoreCreateMutex();
     _ps_wifi_init();
 
     pysim_start();
+
+    // Older simulators only answer with their clock, which leaves batching and offloads off
+    uint32_t options = LINK_OPT_FRAME_FLAGS | LINK_OPT_TX_BATCH | LINK_OPT_WIFI_BATCH;
+#if CONFIG_I4A_CHECKSUM_OFFLOAD && LWIP_CHECKSUM_CTRL_PER_NETIF
+    // Without per-netif checksum control lwIP would keep checking what the simulator fills in
+    options |= LINK_OPT_CHECKSUM_OFFLOAD;
+#endif
+#if CONFIG_I4A_HEADER_COMPRESSION
+    options |= LINK_OPT_HEADER_COMPRESSION;
+#endif
+    if (set_link_options(options, NULL) != ESP_OK) {
+        return;
+    }
+
+    if (hal.link_options & LINK_OPT_TX_BATCH) {
+        ESP_LOGI(TAG, "simulator accepts batched frame transmission");
+    }
+    if (hal.link_options & LINK_OPT_WIFI_BATCH) {
+        ESP_LOGI(TAG, "simulator accepts Wi-Fi transactions");
+    }
+    if (hal.link_options & LINK_OPT_CHECKSUM_OFFLOAD) {
+        esp_err_t ap_err = ps_wlan_set_checksum_offload(WIFI_IF_AP, CHECKSUM_OFFLOAD_FLAGS);
+        esp_err_t sta_err = ps_wlan_set_checksum_offload(WIFI_IF_STA, CHECKSUM_OFFLOAD_FLAGS);
+        if (ap_err != ESP_OK || sta_err != ESP_OK) {
+            // The simulator must not skip checksums lwIP still expects on either interface
+            ESP_LOGW(TAG, "lwIP netifs kept their checksums (AP: %s, STA: %s), disabling checksum offload",
+                     esp_err_to_name(ap_err), esp_err_to_name(sta_err));
+            ps_wlan_set_checksum_offload(WIFI_IF_AP, 0);
+            ps_wlan_set_checksum_offload(WIFI_IF_STA, 0);
+            set_link_options(hal.link_options & ~LINK_OPT_CHECKSUM_OFFLOAD, NULL);
+        }
+    }
+    if (hal.link_options & LINK_OPT_HEADER_COMPRESSION) {
+        ESP_LOGI(TAG, "simulator accepts header compression");
+    }
 }
 
 uint8_t ps_get_config_bits() {
@@ -172,28 +795,158 @@ esp_err_t ps_spi_send(const void *p, size_t len) {
 }
 
 esp_err_t ps_spi_recv(void *p, size_t *len) {
-    spi_packet_t *spi_packet = NULL;
-    while (xQueueReceive(hal.spi_queue, &spi_packet, portMAX_DELAY) != pdTRUE) ;
-    
-    if (spi_packet->len > *len) {
-        ESP_LOGE(TAG, "buffer too small (%lu < %lu)", *len, spi_packet->len);
-        abort();
+    esp_err_t err;
+    while ((err = ps_spi_recv_timeout(p, len, portMAX_DELAY)) == ESP_ERR_TIMEOUT) ;
+    return err;
+}
+
+// Waits up to `timeout` ticks for the consumer lock, leaving the rest of `timeout` for the packet
+static bool spi_lock(TickType_t *timeout) {
+    TickType_t start = xTaskGetTickCount();
+    if (xSemaphoreTake(hal.spi.consumer, *timeout) != pdTRUE) {
+        return false;
     }
 
-    *len = spi_packet->len;
-    memcpy(p, spi_packet->data, spi_packet->len);
-    free(spi_packet);
+    if (*timeout != portMAX_DELAY) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        *timeout = elapsed < *timeout ? *timeout - elapsed : 0;
+    }
+    return true;
+}
+
+// Takes the next packet off the ring, the one left pending by ps_spi_recv_batch first.
+// Must be called with the consumer lock held.
+static spi_packet_t *spi_receive(size_t *len, TickType_t timeout) {
+    spi_packet_t *packet = hal.spi.pending;
+    if (packet) {
+        *len = hal.spi.pending_len;
+        hal.spi.pending = NULL;
+        return packet;
+    }
+
+    size_t sz_item;
+    packet = xRingbufferReceive(hal.spi.ring, &sz_item, timeout);
+    if (packet) {
+        *len = sz_item - sizeof(spi_packet_t);
+    }
+    return packet;
+}
+
+// Copies `packet` into `p` if given and returns it to the ring
+static void spi_release(spi_packet_t *packet, size_t len, void *p) {
+    int64_t waited_us = esp_timer_get_time() - packet->queued_us;
+    if (p) {
+        memcpy(p, packet->data, len);
+    }
+    vRingbufferReturnItem(hal.spi.ring, packet);
+
+    portENTER_CRITICAL(&hal.spi.lock);
+    hal.spi.waiting_packets--;
+    hal.spi.waiting_bytes -= sizeof(spi_packet_t) + len;
+    if (p) {
+        hal.spi.stats.delivered_packets++;
+        hal.spi.stats.delivered_bytes += len;
+        ps_histogram_record(&hal.spi.stats.queue_latency, waited_us > 0 ? (uint32_t)waited_us : 0);
+    } else {
+        hal.spi.stats.drop_oversize++;
+    }
+    portEXIT_CRITICAL(&hal.spi.lock);
+}
+
+esp_err_t ps_spi_recv_timeout(void *p, size_t *len, TickType_t timeout) {
+    if (!p || !len) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    size_t sz = *len;
+    if (!spi_lock(&timeout)) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    esp_err_t err = ESP_OK;
+    spi_packet_t *packet = spi_receive(len, timeout);
+    if (!packet) {
+        err = ESP_ERR_TIMEOUT;
+    } else if (*len > sz) {
+        // Left queued, it would be at the head of the ring for every later call
+        ESP_LOGE(TAG, "buffer too small (%zu < %zu), packet dropped", sz, *len);
+        spi_release(packet, *len, NULL);
+        err = ESP_ERR_INVALID_SIZE;
+    } else {
+        spi_release(packet, *len, p);
+    }
+    xSemaphoreGive(hal.spi.consumer);
+    return err;
+}
+
+esp_err_t ps_spi_recv_batch(void *buffer, size_t sz_buffer, size_t *lens, size_t max_packets, size_t *n_packets, TickType_t timeout) {
+    if (!buffer || !lens || !n_packets || max_packets == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint8_t *out = buffer;
+    size_t used = 0;
+    *n_packets = 0;
+    if (!spi_lock(&timeout)) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    // Only the first packet is waited for, the rest must be queued already
+    spi_packet_t *packet = spi_receive(&lens[0], timeout);
+    if (!packet) {
+        xSemaphoreGive(hal.spi.consumer);
+        return ESP_ERR_TIMEOUT;
+    }
+    if (lens[0] > sz_buffer) {
+        ESP_LOGE(TAG, "buffer too small (%zu < %zu), packet dropped", sz_buffer, lens[0]);
+        spi_release(packet, lens[0], NULL);
+        xSemaphoreGive(hal.spi.consumer);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    while (true) {
+        spi_release(packet, lens[*n_packets], out + used);
+        used += lens[(*n_packets)++];
+        if (*n_packets == max_packets || !(packet = spi_receive(&lens[*n_packets], 0))) {
+            break;
+        }
+
+        // Stays first in line for the next call, which may bring a bigger buffer
+        if (lens[*n_packets] > sz_buffer - used) {
+            hal.spi.pending = packet;
+            hal.spi.pending_len = lens[*n_packets];
+            break;
+        }
+    }
+
+    xSemaphoreGive(hal.spi.consumer);
+    return ESP_OK;
+}
+
+esp_err_t ps_spi_get_stats(ps_spi_stats_t *stats) {
+    if (!stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&hal.spi.lock);
+    *stats = hal.spi.stats;
+    portEXIT_CRITICAL(&hal.spi.lock);
     return ESP_OK;
 }
 
+void ps_spi_reset_stats(void) {
+    portENTER_CRITICAL(&hal.spi.lock);
+    hal.spi.stats = (ps_spi_stats_t){ 0 };
+    portEXIT_CRITICAL(&hal.spi.lock);
+}
+
 /** Creates netifs for AP & STA */
 esp_err_t ps_wifi_init(const wifi_init_config_t *config) {
     return ESP_OK;
 }
 
-esp_err_t ps_wifi_start(void) {
-    ESP_LOGI(TAG, "ps_wifi_start()");
-    ps_query(0x0B);
+// Posts the start events of the interfaces enabled by the current mode
+static void post_start_events(void) {
     if (hal.wlan.mode == WIFI_MODE_AP) {
         esp_event_post(WIFI_EVENT, WIFI_EVENT_AP_START, NULL, 0, portMAX_DELAY);
     } else if (hal.wlan.mode == WIFI_MODE_STA) {
@@ -202,6 +955,12 @@ esp_err_t ps_wifi_start(void) {
         esp_event_post(WIFI_EVENT, WIFI_EVENT_AP_START, NULL, 0, portMAX_DELAY);
         esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_START, NULL, 0, portMAX_DELAY);
     }
+}
+
+esp_err_t ps_wifi_start(void) {
+    ESP_LOGI(TAG, "ps_wifi_start()");
+    ps_query(0x0B);
+    post_start_events();
     return ESP_OK;
 }
 
@@ -211,6 +970,24 @@ esp_err_t ps_wifi_stop(void) {
     return ESP_OK;
 }
 
+// Fills in the arguments of the set config command of `interface` and returns the command, 0 if there is none
+static uint8_t wifi_config_payload(wifi_interface_t interface, const wifi_config_t *conf, wifi_config_payload_t *payload, size_t *len) {
+    *payload = (wifi_config_payload_t){ 0 };
+    if (interface == WIFI_IF_AP) {
+        strcpy(payload->ap.ssid, (char *)conf->ap.ssid);
+        strcpy(payload->ap.password, (char *)conf->ap.password);
+        payload->ap.channel = conf->ap.channel;
+        *len = sizeof(payload->ap);
+        return 0x06;
+    } else if (interface == WIFI_IF_STA) {
+        strcpy(payload->sta.ssid, (char *)conf->sta.ssid);
+        strcpy(payload->sta.password, (char *)conf->sta.password);
+        *len = sizeof(payload->sta);
+        return 0x07;
+    }
+    return 0;
+}
+
 esp_err_t ps_wifi_set_config(wifi_interface_t interface, wifi_config_t *conf) {
     if (interface == WIFI_IF_AP) {
         ESP_LOGI(
@@ -218,15 +995,6 @@ esp_err_t ps_wifi_set_config(wifi_interface_t interface, wifi_config_t *conf) {
             "ps_wifi_set_config(ap, ssid=%s, password=%s, channel=%u)", 
             conf->ap.ssid, conf->ap.password, conf->ap.channel
         );
-        struct {
-            char ssid[32];
-            char password[64];
-            uint32_t channel;
-        } payload = {0};
-        strcpy(payload.ssid, (char *)conf->ap.ssid);
-        strcpy(payload.password, (char *)conf->ap.password);
-        payload.channel = conf->ap.channel;
-        return ps_execute(0x06, &payload, sizeof(payload), NULL, NULL) == 0 ? ESP_OK : ESP_FAIL;
     } else if (interface == WIFI_IF_STA) {
         ESP_LOGI(
             TAG, 
@@ -235,22 +1003,28 @@ esp_err_t ps_wifi_set_config(wifi_interface_t interface, wifi_config_t *conf) {
             conf->sta.bssid[0], conf->sta.bssid[1], conf->sta.bssid[2], conf->sta.bssid[3], 
             conf->sta.bssid[4], conf->sta.bssid[5]
         );
-        struct {
-            char ssid[32];
-            char password[64];
-        } payload = {0};
-        strcpy(payload.ssid, (char *)conf->sta.ssid);
-        strcpy(payload.password, (char *)conf->sta.password);
-        return ps_execute(0x07, &payload, sizeof(payload), NULL, NULL) == 0 ? ESP_OK : ESP_FAIL;
     }
 
-    return ESP_ERR_WIFI_NOT_INIT;
+    wifi_config_payload_t payload;
+    size_t len;
+    uint8_t command = wifi_config_payload(interface, conf, &payload, &len);
+    if (!command) {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    return ps_execute(command, &payload, len, NULL, NULL) == 0 ? ESP_OK : ESP_FAIL;
 }
 
-esp_err_t ps_wifi_set_mode(wifi_mode_t mode) {
-    ESP_LOGI(TAG, "ps_wifi_set_mode(%u)", mode);
+static bool wifi_mode_supported(wifi_mode_t mode) {
     if ((mode != WIFI_MODE_AP) && (mode != WIFI_MODE_STA) && (mode != WIFI_MODE_APSTA)) {
         ESP_LOGE(TAG, "WiFi mode %u not supported by emulator", mode);
+        return false;
+    }
+    return true;
+}
+
+esp_err_t ps_wifi_set_mode(wifi_mode_t mode) {
+    ESP_LOGI(TAG, "ps_wifi_set_mode(%u)", mode);
+    if (!wifi_mode_supported(mode)) {
         return ESP_FAIL;
     }
 
@@ -271,6 +1045,146 @@ esp_err_t ps_wifi_disconnect(void) {
     return ESP_OK;
 }
 
+void ps_wifi_txn_init(ps_wifi_txn_t *txn) {
+    txn->n_ops = 0;
+    txn->len = 0;
+}
+
+static esp_err_t txn_add(ps_wifi_txn_t *txn, uint8_t command, const void *args, uint16_t len) {
+    if (!txn) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (txn->n_ops == PS_WIFI_TXN_MAX_OPS || txn->len + WIFI_OP_HEADER + len > sizeof(txn->batch)) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    uint8_t *op = txn->batch + txn->len;
+    op[0] = command;
+    memcpy(op + 1, &len, sizeof(len));
+    if (len) {
+        memcpy(op + WIFI_OP_HEADER, args, len);
+    }
+    txn->len += WIFI_OP_HEADER + len;
+    txn->n_ops++;
+    return ESP_OK;
+}
+
+esp_err_t ps_wifi_txn_set_mode(ps_wifi_txn_t *txn, wifi_mode_t mode) {
+    if (!wifi_mode_supported(mode)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint32_t mode_u32 = (uint32_t)mode;
+    return txn_add(txn, 0x05, &mode_u32, sizeof(mode_u32));
+}
+
+esp_err_t ps_wifi_txn_set_config(ps_wifi_txn_t *txn, wifi_interface_t interface, const wifi_config_t *conf) {
+    if (!conf) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    wifi_config_payload_t payload;
+    size_t len;
+    uint8_t command = wifi_config_payload(interface, conf, &payload, &len);
+    if (!command) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return txn_add(txn, command, &payload, len);
+}
+
+esp_err_t ps_wifi_txn_start(ps_wifi_txn_t *txn) {
+    return txn_add(txn, 0x0B, NULL, 0);
+}
+
+esp_err_t ps_wifi_txn_stop(ps_wifi_txn_t *txn) {
+    return txn_add(txn, 0x0C, NULL, 0);
+}
+
+esp_err_t ps_wifi_txn_connect(ps_wifi_txn_t *txn) {
+    return txn_add(txn, 0x08, NULL, 0);
+}
+
+esp_err_t ps_wifi_txn_disconnect(ps_wifi_txn_t *txn) {
+    return txn_add(txn, 0x09, NULL, 0);
+}
+
+// Runs the ops of `txn` one command each, up to the first that fails. Returns the number of ops run.
+static size_t txn_execute_each(const ps_wifi_txn_t *txn, uint8_t *statuses) {
+    const uint8_t *op = txn->batch;
+    for (size_t i = 0; i < txn->n_ops; i++) {
+        uint16_t len;
+        memcpy(&len, op + 1, sizeof(len));
+        statuses[i] = ps_execute(op[0], len ? op + WIFI_OP_HEADER : NULL, len, NULL, NULL);
+        if (statuses[i] != 0) {
+            return i + 1;
+        }
+        op += WIFI_OP_HEADER + len;
+    }
+    return txn->n_ops;
+}
+
+// Local side of an op the simulator accepted, as done by its ps_wifi_* function
+static void txn_op_done(uint8_t command, const uint8_t *args) {
+    if (command == 0x05) {
+        uint32_t mode;
+        memcpy(&mode, args, sizeof(mode));
+        hal.wlan.mode = (wifi_mode_t)mode;
+    } else if (command == 0x0B) {
+        post_start_events();
+    }
+}
+
+esp_err_t ps_wifi_txn_commit(ps_wifi_txn_t *txn) {
+    if (!txn) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ESP_LOGI(TAG, "ps_wifi_txn_commit(%zu ops, %zu bytes)", txn->n_ops, txn->len);
+    if (!txn->n_ops) {
+        return ESP_OK;
+    }
+
+    // Events the simulator sends in response to the ops wait until ours are posted
+    xSemaphoreTake(hal.wlan.event_lock, portMAX_DELAY);
+
+    uint8_t statuses[PS_WIFI_TXN_MAX_OPS];
+    size_t n_run;
+    if (hal.link_options & LINK_OPT_WIFI_BATCH) {
+        // One status per op run, the simulator stops at the first that fails
+        n_run = sizeof(statuses);
+        uint8_t ret = ps_execute(CMD_WIFI_BATCH, txn->batch, txn->len, statuses, &n_run);
+        if (ret != 0 && n_run == 0) {
+            ESP_LOGE(TAG, "simulator rejected Wi-Fi transaction: %u", ret);
+        }
+    } else {
+        n_run = txn_execute_each(txn, statuses);
+    }
+
+    esp_err_t err = ESP_OK;
+    const uint8_t *op = txn->batch;
+    for (size_t i = 0; i < txn->n_ops; i++) {
+        uint16_t len;
+        memcpy(&len, op + 1, sizeof(len));
+
+        if (i >= n_run) {
+            txn->results[i] = ESP_ERR_INVALID_STATE;
+        } else if (statuses[i] != 0) {
+            ESP_LOGE(TAG, "Wi-Fi transaction op %zu (0x%02x) failed: %u", i, op[0], statuses[i]);
+            txn->results[i] = ESP_FAIL;
+        } else {
+            txn->results[i] = ESP_OK;
+            txn_op_done(op[0], op + WIFI_OP_HEADER);
+        }
+
+        if (err == ESP_OK) {
+            err = txn->results[i];
+        }
+        op += WIFI_OP_HEADER + len;
+    }
+
+    xSemaphoreGive(hal.wlan.event_lock);
+    return err;
+}
+
 esp_err_t ps_wifi_deauth_sta(uint16_t aid) {
     ESP_LOGI(TAG, "ps_wifi_deauth_sta(%u)", aid);
     return ps_execute(0x0A, &aid, sizeof(aid), NULL, NULL) == 0 ? ESP_OK : ESP_FAIL;
@@ -400,4 +1314,445 @@ esp_netif_t* ps_netif_create_default_wifi_sta() {
 
 esp_err_t ps_netif_destroy_default_wifi(esp_netif_t*) {
     return ESP_OK;
+}
+
+static esp_err_t get_wlan_vnics(wifi_interface_t interface, vnic_t **tx, vnic_t **rx) {
+    if (interface == WIFI_IF_AP) {
+        *tx = &hal.wlan.ap_tx;
+        *rx = &hal.wlan.ap_rx;
+    } else if (interface == WIFI_IF_STA) {
+        *tx = &hal.wlan.sta_tx;
+        *rx = &hal.wlan.sta_rx;
+    } else {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+// A path goes from `sender` to the consumer of `receiver`, the vnic bound to it
+static void get_path_stats(vnic_t *sender, vnic_t *receiver, ps_wlan_path_stats_t *out) {
+    vnic_stats_t tx, rx;
+    vnic_get_stats(sender, &tx);
+    vnic_get_stats(receiver, &rx);
+
+    out->queued_packets = tx.tx_packets;
+    out->queued_bytes = tx.tx_bytes;
+    out->delivered_packets = rx.rx_packets;
+    out->delivered_bytes = rx.rx_bytes;
+    out->drop_no_receiver = tx.tx_drops[VNIC_DROP_NO_RECEIVER] + rx.rx_drops[VNIC_DROP_NO_RECEIVER];
+    out->drop_no_memory = tx.tx_drops[VNIC_DROP_NO_MEMORY] + rx.rx_drops[VNIC_DROP_NO_MEMORY];
+    out->drop_oversize = tx.tx_drops[VNIC_DROP_OVERSIZE] + rx.rx_drops[VNIC_DROP_OVERSIZE];
+    out->drop_queue_full = tx.tx_drops[VNIC_DROP_QUEUE_FULL] + rx.rx_drops[VNIC_DROP_QUEUE_FULL];
+    out->drop_loss = tx.tx_drops[VNIC_DROP_LOSS];
+    out->queue_high_water = tx.tx_queue_high_water;
+}
+
+esp_err_t ps_wlan_send_raw(wifi_interface_t interface, const void *frame, size_t len) {
+    vnic_t *tx, *rx;
+    if (!frame || get_wlan_vnics(interface, &tx, &rx) != ESP_OK) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    switch (vnic_transmit(tx, frame, len)) {
+        case VNIC_OK:
+            return ESP_OK;
+        case VNIC_INVALID_PARAM:
+            return ESP_ERR_INVALID_SIZE;
+        case VNIC_NO_MEMORY:
+            return ESP_ERR_NO_MEM;
+        default:
+            return ESP_FAIL;
+    }
+}
+
+esp_err_t ps_wlan_set_checksum_offload(wifi_interface_t interface, uint16_t flags) {
+    vnic_t *tx, *rx;
+    if (get_wlan_vnics(interface, &tx, &rx) != ESP_OK || (flags & ~CHECKSUM_OFFLOAD_FLAGS)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (flags && !(hal.link_options & LINK_OPT_CHECKSUM_OFFLOAD)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    // The netif is registered on the vnic lwIP writes to
+    switch (vnic_set_checksum_ctrl(tx, NETIF_CHECKSUM_ENABLE_ALL & ~flags)) {
+        case VNIC_OK:
+            return ESP_OK;
+        case VNIC_NOT_SUPPORTED:
+            return ESP_ERR_NOT_SUPPORTED;
+        default:
+            return ESP_ERR_INVALID_STATE;
+    }
+}
+
+esp_err_t ps_wlan_get_stats(wifi_interface_t interface, ps_wlan_stats_t *stats) {
+    vnic_t *tx, *rx;
+    if (!stats || get_wlan_vnics(interface, &tx, &rx) != ESP_OK) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // `tx` is the vnic lwIP writes to, `rx` the one fed by the simulator events
+    get_path_stats(tx, rx, &stats->to_sim);
+    get_path_stats(rx, tx, &stats->from_sim);
+    return ESP_OK;
+}
+
+esp_err_t ps_wlan_reset_stats(wifi_interface_t interface) {
+    vnic_t *tx, *rx;
+    if (get_wlan_vnics(interface, &tx, &rx) != ESP_OK) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    vnic_reset_stats(tx);
+    vnic_reset_stats(rx);
+    return ESP_OK;
+}
+
+// The shaper sits on the sending vnic of the path
+static esp_err_t get_shaped_vnic(wifi_interface_t interface, ps_wlan_direction_t direction, vnic_t **vnic) {
+    vnic_t *tx, *rx;
+    if (get_wlan_vnics(interface, &tx, &rx) != ESP_OK) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (direction == PS_WLAN_TO_SIM) {
+        *vnic = tx;
+    } else if (direction == PS_WLAN_FROM_SIM) {
+        *vnic = rx;
+    } else {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ps_wlan_set_shaping(wifi_interface_t interface, ps_wlan_direction_t direction, const ps_shaping_t *shaping) {
+#if CONFIG_VNIC_SHAPER
+    vnic_t *vnic;
+    if (get_shaped_vnic(interface, direction, &vnic) != ESP_OK) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!shaping) {
+        ESP_LOGI(TAG, "ps_wlan_set_shaping(%u, %u, NULL)", interface, direction);
+        vnic_shaper_disable(vnic);
+        return ESP_OK;
+    }
+
+    ESP_LOGI(
+        TAG, "ps_wlan_set_shaping(%u, %u, %" PRIu32 "bps/%" PRIu32 "B, %" PRIu32 "+%" PRIu32 "us, %" PRIu32 "ppm, %" PRIu32 ")",
+        interface, direction, shaping->rate_bps, shaping->burst_bytes, shaping->delay_us, shaping->jitter_us,
+        shaping->loss_ppm, shaping->queue_len
+    );
+
+    const vnic_shaper_config_t config = {
+        .rate_bps = shaping->rate_bps,
+        .burst_bytes = shaping->burst_bytes,
+        .delay_us = shaping->delay_us,
+        .jitter_us = shaping->jitter_us,
+        .loss_ppm = shaping->loss_ppm,
+        .queue_len = shaping->queue_len,
+    };
+    switch (vnic_shaper_configure(vnic, &config)) {
+        case VNIC_OK:
+            return ESP_OK;
+        case VNIC_NOT_SUPPORTED:
+            return ESP_ERR_NOT_SUPPORTED;
+        case VNIC_NO_MEMORY:
+            return ESP_ERR_NO_MEM;
+        default:
+            return ESP_ERR_INVALID_ARG;
+    }
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t ps_wlan_get_shaping_stats(wifi_interface_t interface, ps_wlan_direction_t direction, ps_shaping_stats_t *stats) {
+    vnic_t *vnic;
+    if (!stats || get_shaped_vnic(interface, direction, &vnic) != ESP_OK) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    vnic_shaper_stats_t shaper;
+    vnic_shaper_get_stats(vnic, &shaper);
+    stats->queued = shaper.queued;
+    stats->delivered = shaper.delivered;
+    stats->drop_loss = shaper.drop_loss;
+    stats->drop_queue_full = shaper.drop_queue_full;
+    stats->queue_high_water = shaper.queue_high_water;
+    stats->throttled = shaper.throttled;
+    stats->blocked = shaper.blocked;
+    return ESP_OK;
+}
+
+esp_err_t ps_latency_enable(bool enable) {
+    ESP_LOGI(TAG, "ps_latency_enable(%u)", enable);
+    // Legacy frame events could not tell timestamped frames from the others
+    if (!(hal.link_options & LINK_OPT_FRAME_FLAGS)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    uint32_t options = (hal.link_options & ~LINK_OPT_FRAME_TIMESTAMPS) | (enable ? LINK_OPT_FRAME_TIMESTAMPS : 0);
+    int64_t offset;
+    if (set_link_options(options, &offset) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    if (enable && !(hal.link_options & LINK_OPT_FRAME_TIMESTAMPS)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    // Frames carry their own timestamps, so this only decides which ones are recorded
+    if (enable) {
+        frame_latency_reset();
+    }
+    frame_latency_set_enabled(enable, enable ? offset : 0);
+    return ESP_OK;
+}
+
+esp_err_t ps_latency_get(ps_latency_stage_t stage, ps_histogram_t *histogram) {
+    if (stage >= PS_LATENCY_MAX || !histogram) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    frame_latency_get(stage, histogram);
+    return ESP_OK;
+}
+
+void ps_latency_reset(void) {
+    frame_latency_reset();
+}
+
+esp_err_t ps_compress_enable(bool enable) {
+#if CONFIG_I4A_HEADER_COMPRESSION
+    ESP_LOGI(TAG, "ps_compress_enable(%u)", enable);
+    // Frames from the simulator are only compressed on framed events
+    if (!(hal.link_options & LINK_OPT_FRAME_FLAGS)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    uint32_t options = (hal.link_options & ~LINK_OPT_HEADER_COMPRESSION) | (enable ? LINK_OPT_HEADER_COMPRESSION : 0);
+    if (set_link_options(options, NULL) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    if (enable && !(hal.link_options & LINK_OPT_HEADER_COMPRESSION)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t ps_compress_get_stats(wifi_interface_t interface, ps_wlan_direction_t direction, ps_compress_stats_t *stats) {
+#if CONFIG_I4A_HEADER_COMPRESSION
+    frame_compress_t *compress;
+    if (!stats || (interface != WIFI_IF_AP && interface != WIFI_IF_STA)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (direction == PS_WLAN_TO_SIM) {
+        compress = interface == WIFI_IF_AP ? &hal.compress.ap_tx : &hal.compress.sta_tx;
+    } else if (direction == PS_WLAN_FROM_SIM) {
+        compress = interface == WIFI_IF_AP ? &hal.compress.ap_rx : &hal.compress.sta_rx;
+    } else {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    frame_compress_stats_t codec;
+    frame_compress_get_stats(compress, &codec);
+    stats->frames = codec.frames;
+    stats->full_headers = codec.full_headers;
+    stats->delta_headers = codec.delta_headers;
+    stats->raw_frames = codec.raw_frames;
+    stats->errors = codec.errors;
+    stats->frame_bytes = codec.frame_bytes;
+    stats->link_bytes = codec.link_bytes;
+    stats->cost_avg = codec.frames ? (uint32_t)(codec.cost_total / codec.frames) : 0;
+    stats->cost_max = codec.cost_max;
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+void ps_compress_reset_stats(void) {
+#if CONFIG_I4A_HEADER_COMPRESSION
+    frame_compress_reset_stats(&hal.compress.ap_tx);
+    frame_compress_reset_stats(&hal.compress.ap_rx);
+    frame_compress_reset_stats(&hal.compress.sta_tx);
+    frame_compress_reset_stats(&hal.compress.sta_rx);
+#endif
+}
+
+esp_err_t ps_rx_pipeline_get_stats(wifi_interface_t interface, ps_rx_pipeline_stats_t *stats) {
+#if CONFIG_I4A_RX_PIPELINES
+    if (!stats || (interface != WIFI_IF_AP && interface != WIFI_IF_STA)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    rx_pipeline_t *pipeline = interface == WIFI_IF_AP ? &hal.rx.ap : &hal.rx.sta;
+    portENTER_CRITICAL(&pipeline->lock);
+    *stats = pipeline->stats;
+    portEXIT_CRITICAL(&pipeline->lock);
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+#if CONFIG_VNIC_PCAP
+
+// Path index (see ps_pcap_path_t) of the vnic with ID `id`
+static uint8_t pcap_path(uint8_t id) {
+    vnic_t *paths[] = { &hal.wlan.ap_tx, &hal.wlan.ap_rx, &hal.wlan.sta_tx, &hal.wlan.sta_rx };
+    for (uint8_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        if (paths[i]->id == id) {
+            return i;
+        }
+    }
+    return 0xFF;
+}
+
+// CMD_PCAP_DATA payload: uint16_t snaplen, then for every frame a uint8_t path
+// index, a pcap record header and the captured bytes.
+static void pcap_task() {
+    static uint8_t chunk[PCAP_CHUNK_SIZE];
+    static vnic_pcap_record_t record;
+    bool pending = false;
+
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_I4A_PCAP_FLUSH_MS));
+
+        do {
+            memcpy(chunk, &hal.pcap.snaplen, sizeof(uint16_t));
+            size_t used = sizeof(uint16_t), frames = 0;
+
+            while (pending || vnic_pcap_next(&record)) {
+                size_t record_len = 1 + 4 * sizeof(uint32_t) + record.caplen;
+                if (used + record_len > sizeof(chunk)) {
+                    pending = true;
+                    break;
+                }
+
+                uint32_t header[4] = {
+                    (uint32_t)(record.timestamp_us / 1000000),
+                    (uint32_t)(record.timestamp_us % 1000000),
+                    record.caplen,
+                    record.len,
+                };
+                chunk[used] = pcap_path(record.vnic);
+                memcpy(chunk + used + 1, header, sizeof(header));
+                memcpy(chunk + used + 1 + sizeof(header), record.data, record.caplen);
+                used += record_len;
+                frames++;
+                pending = false;
+            }
+
+            if (frames == 0) {
+                break;
+            }
+
+            if (ps_execute(CMD_PCAP_DATA, chunk, used, NULL, NULL) != 0) {
+                hal.pcap.stream_errors++;
+            } else {
+                hal.pcap.streamed += frames;
+                hal.pcap.stream_bytes += used;
+            }
+        } while (pending);
+    }
+}
+
+#endif
+
+esp_err_t ps_pcap_start(uint16_t snaplen, uint32_t paths) {
+#if CONFIG_VNIC_PCAP
+    ESP_LOGI(TAG, "ps_pcap_start(%u, 0x%02" PRIx32 ")", snaplen, paths);
+    vnic_t *vnics[] = { &hal.wlan.ap_tx, &hal.wlan.ap_rx, &hal.wlan.sta_tx, &hal.wlan.sta_rx };
+    uint32_t vnic_mask = 0;
+    for (size_t i = 0; i < sizeof(vnics) / sizeof(vnics[0]); i++) {
+        if (paths & (1u << i)) {
+            vnic_mask |= 1u << vnics[i]->id;
+        }
+    }
+
+    switch (vnic_pcap_start(snaplen, vnic_mask)) {
+        case VNIC_OK:
+            break;
+        case VNIC_NO_MEMORY:
+            return ESP_ERR_NO_MEM;
+        default:
+            return ESP_ERR_INVALID_ARG;
+    }
+
+    hal.pcap.snaplen = snaplen;
+    if (!hal.pcap.task) {
+        xTaskCreatePinnedToCore(pcap_task, "pcap_task", CONFIG_I4A_PCAP_TASK_STACK_SIZE, NULL, CONFIG_I4A_PCAP_TASK_PRIORITY, &hal.pcap.task, PCAP_TASK_CORE);
+        ps_mem_register_task(PS_MEM_PCAP, hal.pcap.task, CONFIG_I4A_PCAP_TASK_STACK_SIZE);
+        ps_mem_add_static(PS_MEM_PCAP, PCAP_CHUNK_SIZE);
+    }
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t ps_pcap_stop(void) {
+    ESP_LOGI(TAG, "ps_pcap_stop()");
+    vnic_pcap_stop();
+    return ESP_OK;
+}
+
+void ps_pcap_get_stats(ps_pcap_stats_t *stats) {
+    vnic_pcap_stats_t ring;
+    vnic_pcap_get_stats(&ring);
+
+    stats->captured = ring.captured;
+    stats->overruns = ring.overruns;
+    stats->streamed = hal.pcap.streamed;
+    stats->stream_bytes = hal.pcap.stream_bytes;
+    stats->stream_errors = hal.pcap.stream_errors;
+    stats->cost_avg = ring.captured ? (uint32_t)(ring.cost_total / ring.captured) : 0;
+    stats->cost_max = ring.cost_max;
+}
+
+esp_err_t ps_bridge_set_enabled(bool enabled) {
+    ESP_LOGI(TAG, "ps_bridge_set_enabled(%u)", enabled);
+    vnic_bridge_set_enabled(&hal.wlan.bridge, enabled);
+    if (!enabled) {
+        vnic_bridge_flush(&hal.wlan.bridge);
+    }
+    return ESP_OK;
+}
+
+esp_err_t ps_bridge_flush(void) {
+    vnic_bridge_flush(&hal.wlan.bridge);
+    return ESP_OK;
+}
+
+esp_err_t ps_bridge_get_stats(wifi_interface_t interface, ps_bridge_stats_t *stats) {
+    size_t port;
+    if (interface == WIFI_IF_AP) {
+        port = hal.wlan.ap_port;
+    } else if (interface == WIFI_IF_STA) {
+        port = hal.wlan.sta_port;
+    } else {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    vnic_bridge_port_stats_t port_stats;
+    if (!stats || vnic_bridge_get_port_stats(&hal.wlan.bridge, port, &port_stats) != VNIC_OK) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    stats->rx_packets = port_stats.rx_packets;
+    stats->rx_bytes = port_stats.rx_bytes;
+    stats->tx_packets = port_stats.tx_packets;
+    stats->tx_bytes = port_stats.tx_bytes;
+    stats->local_packets = port_stats.local_packets;
+    stats->flooded_packets = port_stats.flooded_packets;
+    stats->filtered_packets = port_stats.filtered_packets;
+    stats->tx_errors = port_stats.tx_errors;
+    return ESP_OK;
 }
\ No newline at end of file
@@ -15,9 +15,40 @@ uint8_t ps_get_config_bits();
 /** -- config -- */
 
 /** -- spi -- */
+typedef struct {
+    uint32_t queued_packets;        // Packets read from the link and queued for ps_spi_recv
+    uint32_t queued_bytes;
+    uint32_t delivered_packets;     // Packets returned by ps_spi_recv*
+    uint32_t delivered_bytes;
+    uint32_t drop_queue_full;       // Ring still full after CONFIG_I4A_SPI_ENQUEUE_WAIT_MS
+    uint32_t drop_no_memory;        // Packet larger than the ring can hold
+    uint32_t drop_oversize;         // Packet larger than the buffer handed to ps_spi_recv*
+    uint32_t queue_high_water;      // Max number of packets seen waiting
+    uint32_t ring_high_water;       // Max bytes of the ring seen in use, headers included
+    ps_histogram_t queue_latency;   // Packet read from the link -> returned by ps_spi_recv*
+} ps_spi_stats_t;
+
 esp_err_t ps_spi_init();
 esp_err_t ps_spi_send(const void *p, size_t len);
+// Waits for the next SPI packet. `len` holds the size of `p` and receives the packet length.
 esp_err_t ps_spi_recv(void *p, size_t *len);
+// Same as ps_spi_recv, but gives up after `timeout` ticks.
+//
+// Returns ESP_ERR_TIMEOUT if no packet arrived in time, and ESP_ERR_INVALID_SIZE if
+// the packet does not fit in `p`. The packet is then dropped, counted in drop_oversize,
+// and `len` receives its length. Several tasks may receive at once.
+esp_err_t ps_spi_recv_timeout(void *p, size_t *len, TickType_t timeout);
+// Waits up to `timeout` ticks for a packet, then also takes the ones already queued.
+//
+// Packets are stored back to back in `buffer`, up to `max_packets` or as long as they
+// fit in `sz_buffer`, and their lengths in `lens`. `n_packets` receives their number.
+// Returns ESP_ERR_TIMEOUT if no packet arrived in time and ESP_ERR_INVALID_SIZE if the
+// first packet does not fit, which is dropped like by ps_spi_recv_timeout and its length
+// stored in lens[0]. A later packet that does not fit in the room left is returned first
+// by the next call.
+esp_err_t ps_spi_recv_batch(void *buffer, size_t sz_buffer, size_t *lens, size_t max_packets, size_t *n_packets, TickType_t timeout);
+esp_err_t ps_spi_get_stats(ps_spi_stats_t *stats);
+void ps_spi_reset_stats(void);
 /** -- spi -- */
 
 /** -- wifi -- */
@@ -38,8 +69,214 @@ esp_err_t ps_wifi_set_max_tx_power(int8_t power);
 esp_netif_t* ps_netif_create_default_wifi_ap();
 esp_netif_t* ps_netif_create_default_wifi_sta();
 esp_err_t ps_netif_destroy_default_wifi(esp_netif_t*);
+// Sends an Ethernet frame through `interface` as if lwIP had sent it
+esp_err_t ps_wlan_send_raw(wifi_interface_t interface, const void *frame, size_t len);
+// Hands the NETIF_CHECKSUM_* checksums in `flags` over to the simulator, lwIP keeps the rest.
+//
+// Set by i4a_pysim_init if CONFIG_I4A_CHECKSUM_OFFLOAD and lwIP has LWIP_CHECKSUM_CTRL_PER_NETIF,
+// which withdraws the offload from the simulator if either interface fails; 0 makes lwIP
+// handle every checksum again.
+// Returns ESP_ERR_NOT_SUPPORTED if the simulator did not accept the offload or lwIP
+// lacks LWIP_CHECKSUM_CTRL_PER_NETIF.
+esp_err_t ps_wlan_set_checksum_offload(wifi_interface_t interface, uint16_t flags);
 /** -- wifi -- */
 
+/** -- wifi transaction -- */
+#define PS_WIFI_TXN_MAX_OPS 8
+// Room for PS_WIFI_TXN_MAX_OPS ops, an AP config being the largest
+#define PS_WIFI_TXN_BATCH_SIZE (PS_WIFI_TXN_MAX_OPS * 104)
+
+typedef struct {
+    size_t n_ops;
+    size_t len;                                 // Bytes of `batch` in use
+    esp_err_t results[PS_WIFI_TXN_MAX_OPS];     // Outcome of each op, filled in by ps_wifi_txn_commit
+    uint8_t batch[PS_WIFI_TXN_BATCH_SIZE];
+} ps_wifi_txn_t;
+
+// Queues Wi-Fi control operations to run them in a single round trip, e.g. to bring up a node:
+//
+//     ps_wifi_txn_t txn;
+//     ps_wifi_txn_init(&txn);
+//     ps_wifi_txn_set_mode(&txn, WIFI_MODE_STA);
+//     ps_wifi_txn_set_config(&txn, WIFI_IF_STA, &config);
+//     ps_wifi_txn_start(&txn);
+//     ps_wifi_txn_connect(&txn);
+//     ESP_ERROR_CHECK(ps_wifi_txn_commit(&txn));
+//
+// Adding an op returns ESP_ERR_NO_MEM once PS_WIFI_TXN_MAX_OPS are queued.
+void ps_wifi_txn_init(ps_wifi_txn_t *txn);
+esp_err_t ps_wifi_txn_set_mode(ps_wifi_txn_t *txn, wifi_mode_t mode);
+esp_err_t ps_wifi_txn_set_config(ps_wifi_txn_t *txn, wifi_interface_t interface, const wifi_config_t *conf);
+esp_err_t ps_wifi_txn_start(ps_wifi_txn_t *txn);
+esp_err_t ps_wifi_txn_stop(ps_wifi_txn_t *txn);
+esp_err_t ps_wifi_txn_connect(ps_wifi_txn_t *txn);
+esp_err_t ps_wifi_txn_disconnect(ps_wifi_txn_t *txn);
+// Runs the queued ops in order and stops at the first one the simulator rejects.
+//
+// results[i] receives ESP_OK, ESP_FAIL if the op was rejected or ESP_ERR_INVALID_STATE if it
+// did not run. The WIFI_EVENT_* of the ops that succeeded are posted in order, before any
+// event the simulator sends in response to them. Simulators without transaction support
+// get one command per op. Returns the result of the first op that did not succeed.
+esp_err_t ps_wifi_txn_commit(ps_wifi_txn_t *txn);
+/** -- wifi transaction -- */
+
+/** -- stats -- */
+typedef struct {
+    uint32_t queued_packets;    // Frames accepted by the path queue
+    uint32_t queued_bytes;
+    uint32_t delivered_packets; // Frames taken out of the path queue
+    uint32_t delivered_bytes;
+    uint32_t drop_no_receiver;
+    uint32_t drop_no_memory;
+    uint32_t drop_oversize;
+    uint32_t drop_queue_full;   // Queue still full after CONFIG_I4A_VNIC_TX_TIMEOUT_MS
+    uint32_t drop_loss;         // Random loss of the shaper, see ps_wlan_set_shaping
+    uint32_t queue_high_water;  // Max number of frames seen waiting in the path queue
+} ps_wlan_path_stats_t;
+
+typedef struct {
+    ps_wlan_path_stats_t to_sim;    // lwIP (or the bridge) -> nic_task -> simulator
+    ps_wlan_path_stats_t from_sim;  // simulator event -> vnic rx task -> lwIP
+} ps_wlan_stats_t;
+
+esp_err_t ps_wlan_get_stats(wifi_interface_t interface, ps_wlan_stats_t *stats);
+esp_err_t ps_wlan_reset_stats(wifi_interface_t interface);
+/** -- stats -- */
+
+/** -- shaping -- */
+typedef enum {
+    PS_WLAN_TO_SIM = 0,     // lwIP (or the bridge) -> simulator
+    PS_WLAN_FROM_SIM,       // simulator -> lwIP
+} ps_wlan_direction_t;
+
+typedef struct {
+    uint32_t rate_bps;      // Token bucket rate in bits per second, 0 for no rate limit
+    uint32_t burst_bytes;   // Bucket depth, at least one full frame
+    uint32_t delay_us;      // Fixed delay added to every frame
+    uint32_t jitter_us;     // Uniform random delay of up to jitter_us added on top of delay_us
+    uint32_t loss_ppm;      // Frames dropped at random, in parts per million
+    uint32_t queue_len;     // Frames held before new ones are dropped, 0 for CONFIG_VNIC_SHAPER_QUEUE_LEN
+} ps_shaping_t;
+
+typedef struct {
+    uint32_t queued;            // Frames accepted by the shaper
+    uint32_t delivered;         // Frames released to the path queue
+    uint32_t drop_loss;         // Frames dropped by the random loss
+    uint32_t drop_queue_full;   // Frames dropped because queue_len frames were already waiting
+    uint32_t queue_high_water;  // Max number of frames seen waiting in the shaper
+    uint32_t throttled;         // Times a due frame had to wait for tokens
+    uint32_t blocked;           // Times a due frame found the path queue full
+} ps_shaping_stats_t;
+
+// Shapes the frames of one direction of `interface`, or stops shaping them if `shaping` is NULL.
+// Can be called at any time, frames keep their order. Delays are rounded up to the FreeRTOS tick.
+// Returns ESP_ERR_NOT_SUPPORTED if built without CONFIG_VNIC_SHAPER.
+esp_err_t ps_wlan_set_shaping(wifi_interface_t interface, ps_wlan_direction_t direction, const ps_shaping_t *shaping);
+esp_err_t ps_wlan_get_shaping_stats(wifi_interface_t interface, ps_wlan_direction_t direction, ps_shaping_stats_t *stats);
+/** -- shaping -- */
+
+/** -- latency -- */
+typedef enum {
+    PS_LATENCY_RX_SIM_TO_LINK = 0,  // Simulator timestamp -> event read from the link
+    PS_LATENCY_RX_LINK_TO_VNIC,     // Event read from the link -> frame queued on the vnic
+    PS_LATENCY_RX_VNIC_QUEUE,       // Frame queued -> dequeued by the vnic rx task
+    PS_LATENCY_RX_LWIP,             // Frame dequeued -> processed by cb_lwip_input
+    PS_LATENCY_RX_TOTAL,            // Simulator timestamp -> processed by cb_lwip_input
+    PS_LATENCY_TX_VNIC_QUEUE,       // Frame emitted by lwIP -> dequeued by nic_task_*
+    PS_LATENCY_TX_LINK,             // Frame dequeued -> acknowledged by the simulator
+    PS_LATENCY_TX_TOTAL,            // Frame emitted by lwIP -> acknowledged by the simulator
+    PS_LATENCY_MAX
+} ps_latency_stage_t;
+
+// Asks the simulator to timestamp WLAN frame events and starts tracking per-stage latencies.
+// Returns ESP_ERR_NOT_SUPPORTED unless the simulator frames its events (LINK_OPT_FRAME_FLAGS).
+esp_err_t ps_latency_enable(bool enable);
+esp_err_t ps_latency_get(ps_latency_stage_t stage, ps_histogram_t *histogram);
+void ps_latency_reset(void);
+/** -- latency -- */
+
+/** -- compression -- */
+typedef struct {
+    uint32_t frames;        // Frames encoded (to the simulator) or decoded (from the simulator)
+    uint32_t full_headers;  // Frames that set up the context of their flow
+    uint32_t delta_headers; // Frames sent as the bytes that changed since the previous header of their flow
+    uint32_t raw_frames;    // Frames sent as is
+    uint32_t errors;        // Frames dropped because their context was lost on the link
+    uint64_t frame_bytes;   // Bytes before encoding or after decoding
+    uint64_t link_bytes;    // Bytes on the link, link_bytes / frame_bytes is the compression ratio
+    uint32_t cost_avg;      // CPU cycles per frame (ns on the linux target)
+    uint32_t cost_max;
+} ps_compress_stats_t;
+
+// Asks the simulator to compress the Ethernet/IPv4/TCP/UDP headers of WLAN frames in both
+// directions. Negotiated by i4a_pysim_init if CONFIG_I4A_HEADER_COMPRESSION. Frames from
+// the simulator say whether they are compressed, frames sent to it while it is switched
+// may be dropped.
+esp_err_t ps_compress_enable(bool enable);
+esp_err_t ps_compress_get_stats(wifi_interface_t interface, ps_wlan_direction_t direction, ps_compress_stats_t *stats);
+void ps_compress_reset_stats(void);
+/** -- compression -- */
+
+/** -- rx pipelines -- */
+typedef struct {
+    uint32_t queued;                // Frame events copied into a buffer of the pipeline by the polling task
+    uint32_t processed;             // Frame events handed to lwIP or the bridge by the pipeline task
+    uint32_t waited;                // Times the polling task had to wait for a free buffer
+    uint32_t buffers_high_water;    // Max number of buffers seen in use, up to CONFIG_I4A_RX_PIPELINE_BUFFERS
+} ps_rx_pipeline_stats_t;
+
+// Counters of the receive pipeline of `interface`.
+// Returns ESP_ERR_NOT_SUPPORTED if built without CONFIG_I4A_RX_PIPELINES.
+esp_err_t ps_rx_pipeline_get_stats(wifi_interface_t interface, ps_rx_pipeline_stats_t *stats);
+/** -- rx pipelines -- */
+
+/** -- bridge -- */
+typedef struct {
+    uint32_t rx_packets;        // Frames received from the simulator on this interface
+    uint32_t rx_bytes;
+    uint32_t tx_packets;        // Frames switched out of this interface
+    uint32_t tx_bytes;
+    uint32_t local_packets;     // Frames handed to lwIP
+    uint32_t flooded_packets;   // Broadcast or unknown destination frames
+    uint32_t filtered_packets;  // Frames whose destination lives on the same interface
+    uint32_t tx_errors;
+} ps_bridge_stats_t;
+
+// Switches frames between the AP and STA interfaces without going through lwIP.
+// Frames addressed to this node are still delivered to lwIP. Disabled by default.
+esp_err_t ps_bridge_set_enabled(bool enabled);
+esp_err_t ps_bridge_flush(void);
+esp_err_t ps_bridge_get_stats(wifi_interface_t interface, ps_bridge_stats_t *stats);
+/** -- bridge -- */
+
+/** -- pcap -- */
+typedef enum {
+    PS_PCAP_AP_TX = 1 << 0,   // lwIP (or the bridge) -> simulator, AP interface
+    PS_PCAP_AP_RX = 1 << 1,   // simulator -> lwIP, AP interface
+    PS_PCAP_STA_TX = 1 << 2,
+    PS_PCAP_STA_RX = 1 << 3,
+    PS_PCAP_ALL = 0x0F,
+} ps_pcap_path_t;
+
+typedef struct {
+    uint32_t captured;      // Frames copied into the capture ring
+    uint32_t overruns;      // Frames overwritten before being streamed
+    uint32_t streamed;      // Frames sent to the simulator
+    uint32_t stream_bytes;
+    uint32_t stream_errors; // Chunks the simulator rejected
+    uint32_t cost_avg;      // CPU cycles per captured frame on the data path (ns on the linux target)
+    uint32_t cost_max;
+} ps_pcap_stats_t;
+
+// Copies the first `snaplen` bytes of every frame crossing `paths` (ps_pcap_path_t bits)
+// into a ring that a low priority task streams to the simulator as pcap records.
+// The data path never blocks on the capture: frames are overwritten if streaming falls behind.
+// snaplen is bounded by CONFIG_VNIC_PCAP_MAX_SNAPLEN.
+esp_err_t ps_pcap_start(uint16_t snaplen, uint32_t paths);
+esp_err_t ps_pcap_stop(void);
+void ps_pcap_get_stats(ps_pcap_stats_t *stats);
+/** -- pcap -- */
+
 // Replace esp_wifi_* functions with ps_wifi_*
 #define esp_wifi_init ps_wifi_init
 #define esp_wifi_start ps_wifi_start
@@ -3,22 +3,36 @@
 #include <stdint.h>
 
 #include "virtual_nic.h"
+#include "pysim.h"
+#include "vnic_pcap.h"
+#include "vnic_shaper.h"
+#include "pysim_trace.h"
+#include "esp_timer.h"
 
 typedef struct buffer
 {
     uint8_t *data;
     size_t len;
+    vnic_meta_t meta;
 } buffer_t;
 
 vnic_result_t vnic_create(vnic_t *self)
 {
+    static uint8_t next_id = 0;
+
+    self->id = next_id++;
     self->next = NULL;
     self->esp_driver = NULL;
-    self->rx_queue = xQueueCreate(1, sizeof(buffer_t));
+    self->tx_timeout = portMAX_DELAY;
+    portMUX_INITIALIZE(&self->stats_lock);
+    self->stats = (vnic_stats_t){0};
+    self->shaper = NULL;
+    self->rx_queue = xQueueCreate(CONFIG_VNIC_RX_QUEUE_LEN, sizeof(buffer_t));
     if (!self->rx_queue)
     {
         return VNIC_NO_MEMORY;
     }
+    ps_mem_add_static(PS_MEM_VNIC, CONFIG_VNIC_RX_QUEUE_LEN * sizeof(buffer_t));
     return VNIC_OK;
 }
 
@@ -28,60 +42,205 @@ vnic_result_t vnic_bind_receiver(vnic_t *self, vnic_t *rx)
     return VNIC_OK;
 }
 
+void vnic_set_tx_timeout(vnic_t *self, TickType_t timeout)
+{
+    self->tx_timeout = timeout;
+}
+
 vnic_result_t vnic_transmit(vnic_t *self, const uint8_t *buffer, size_t len)
+{
+    return vnic_transmit_meta(self, buffer, len, NULL);
+}
+
+vnic_result_t vnic_transmit_meta(vnic_t *self, const uint8_t *buffer, size_t len, const vnic_meta_t *meta)
 {
     if (len > VNIC_MAX_LEN)
     {
+        vnic_count_tx_drop(self, VNIC_DROP_OVERSIZE);
         return VNIC_INVALID_PARAM;
     }
 
     if (!self->next)
+    {
+        vnic_count_tx_drop(self, VNIC_DROP_NO_RECEIVER);
+        return VNIC_NO_RECEIVER;
+    }
+
+    uint8_t *frame = ps_frame_alloc(PS_MEM_VNIC, len);
+    if (!frame)
+    {
+        vnic_count_tx_drop(self, VNIC_DROP_NO_MEMORY);
+        return VNIC_NO_MEMORY;
+    }
+
+    memcpy(frame, buffer, len);
+    vnic_meta_t frame_meta;
+    if (meta)
+    {
+        frame_meta = *meta;
+        frame_meta.queued_us = esp_timer_get_time();
+    }
+
+    vnic_result_t err;
+    if (!vnic_shaper_submit(self, frame, len, meta ? &frame_meta : NULL, &err))
+    {
+        err = vnic_deliver_frame(self, frame, len, meta ? &frame_meta : NULL, self->tx_timeout);
+        if (err != VNIC_OK)
+        {
+            ps_frame_free(frame);
+            vnic_count_tx_drop(self, err == VNIC_NO_RECEIVER ? VNIC_DROP_NO_RECEIVER : VNIC_DROP_QUEUE_FULL);
+        }
+    }
+
+    // `frame` belongs to the receiver or the shaper by now, trace the caller's copy
+    if (err == VNIC_OK)
+    {
+        PS_TRACE(PS_TRACE_VNIC, self->id, PS_TRACE_OUT, buffer, len);
+        vnic_pcap_capture(self, buffer, len);
+    }
+    return err;
+}
+
+vnic_result_t vnic_deliver_frame(vnic_t *self, uint8_t *frame, size_t len, const vnic_meta_t *meta, TickType_t timeout)
+{
+    vnic_t *rx = self->next;
+    if (!rx)
     {
         return VNIC_NO_RECEIVER;
     }
 
     buffer_t tx_buffer = {
-        .data = calloc(1, len),
+        .data = frame,
         .len = len,
     };
-
-    if (!tx_buffer.data)
+    if (meta)
     {
-        return VNIC_NO_MEMORY;
+        tx_buffer.meta = *meta;
     }
 
-    memcpy(tx_buffer.data, buffer, len);
-    while (xQueueSend(self->next->rx_queue, &tx_buffer, portMAX_DELAY) != pdTRUE)
+    while (xQueueSend(rx->rx_queue, &tx_buffer, timeout) != pdTRUE)
     {
+        if (timeout != portMAX_DELAY)
+        {
+            return VNIC_BUFFER_FULL;
+        }
         // Keep retrying to send -- receiver may be busy
     }
+
+    UBaseType_t waiting = uxQueueMessagesWaiting(rx->rx_queue);
+    portENTER_CRITICAL(&self->stats_lock);
+    self->stats.tx_packets++;
+    self->stats.tx_bytes += len;
+    if (waiting > self->stats.tx_queue_high_water)
+    {
+        self->stats.tx_queue_high_water = waiting;
+    }
+    portEXIT_CRITICAL(&self->stats_lock);
     return VNIC_OK;
 }
 
 vnic_result_t vnic_receive(vnic_t *self, uint8_t *buffer, size_t buffer_sz, size_t *bytes_written)
+{
+    return vnic_receive_meta(self, buffer, buffer_sz, bytes_written, NULL);
+}
+
+vnic_result_t vnic_receive_meta(vnic_t *self, uint8_t *buffer, size_t buffer_sz, size_t *bytes_written, vnic_meta_t *meta)
+{
+    vnic_result_t err;
+    while ((err = vnic_receive_timeout(self, buffer, buffer_sz, bytes_written, meta, portMAX_DELAY)) == VNIC_TIMEOUT)
+    {
+        // keep waiting until someone sends something
+    }
+    return err;
+}
+
+vnic_result_t vnic_receive_timeout(vnic_t *self, uint8_t *buffer, size_t buffer_sz, size_t *bytes_written, vnic_meta_t *meta, TickType_t timeout)
 {
     if (buffer_sz < VNIC_MAX_LEN)
     {
         return VNIC_INVALID_PARAM;
     }
 
+    uint8_t *frame;
+    size_t len;
+    vnic_result_t err = vnic_receive_frame(self, &frame, &len, meta, timeout);
+    if (err != VNIC_OK)
+    {
+        return err;
+    }
+
+    memcpy(buffer, frame, len);
+    if (bytes_written)
+        *bytes_written = len;
+
+    vnic_release_frame(frame);
+    return VNIC_OK;
+}
+
+vnic_result_t vnic_receive_frame(vnic_t *self, uint8_t **frame, size_t *len, vnic_meta_t *meta, TickType_t timeout)
+{
     buffer_t rx_buffer = {0};
-    while (xQueueReceive(self->rx_queue, &rx_buffer, portMAX_DELAY) != pdTRUE)
+    if (xQueueReceive(self->rx_queue, &rx_buffer, timeout) != pdTRUE)
     {
-        // keep waiting until someone sends something
+        return VNIC_TIMEOUT;
     }
 
-    memcpy(buffer, rx_buffer.data, rx_buffer.len);
+    PS_TRACE(PS_TRACE_VNIC, self->id, PS_TRACE_IN, rx_buffer.data, rx_buffer.len);
 
-    if (bytes_written)
-        *bytes_written = rx_buffer.len;
+    *frame = rx_buffer.data;
+    *len = rx_buffer.len;
+    if (meta)
+        *meta = rx_buffer.meta;
 
-    free(rx_buffer.data);
+    portENTER_CRITICAL(&self->stats_lock);
+    self->stats.rx_packets++;
+    self->stats.rx_bytes += rx_buffer.len;
+    portEXIT_CRITICAL(&self->stats_lock);
     return VNIC_OK;
 }
 
+void vnic_release_frame(uint8_t *frame)
+{
+    ps_frame_free(frame);
+}
+
 void vnic_destroy(vnic_t *self)
 {
+    vnic_shaper_destroy(self);
     vQueueDelete(self->rx_queue);
     *self = (vnic_t){0};
+}
+
+void vnic_count_rx_drop(vnic_t *self, vnic_drop_reason_t reason)
+{
+    if (reason < VNIC_DROP_MAX)
+    {
+        portENTER_CRITICAL(&self->stats_lock);
+        self->stats.rx_drops[reason]++;
+        portEXIT_CRITICAL(&self->stats_lock);
+    }
+}
+
+void vnic_count_tx_drop(vnic_t *self, vnic_drop_reason_t reason)
+{
+    if (reason < VNIC_DROP_MAX)
+    {
+        portENTER_CRITICAL(&self->stats_lock);
+        self->stats.tx_drops[reason]++;
+        portEXIT_CRITICAL(&self->stats_lock);
+    }
+}
+
+void vnic_get_stats(vnic_t *self, vnic_stats_t *stats)
+{
+    portENTER_CRITICAL(&self->stats_lock);
+    *stats = self->stats;
+    portEXIT_CRITICAL(&self->stats_lock);
+}
+
+void vnic_reset_stats(vnic_t *self)
+{
+    portENTER_CRITICAL(&self->stats_lock);
+    self->stats = (vnic_stats_t){0};
+    portEXIT_CRITICAL(&self->stats_lock);
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "esp_netif.h"
 
@@ -15,14 +16,52 @@ typedef enum vnic_result
     VNIC_INVALID_PARAM,
     VNIC_NO_RECEIVER,
     VNIC_BUFFER_FULL,
-    VNIC_NO_MEMORY
+    VNIC_NO_MEMORY,
+    VNIC_TIMEOUT,
+    VNIC_NOT_SUPPORTED
 } vnic_result_t;
 
+typedef enum vnic_drop_reason
+{
+    VNIC_DROP_NO_RECEIVER = 0,
+    VNIC_DROP_NO_MEMORY,
+    VNIC_DROP_OVERSIZE,
+    VNIC_DROP_QUEUE_FULL,
+    VNIC_DROP_LOSS,         // Random loss of the shaper
+    VNIC_DROP_MAX
+} vnic_drop_reason_t;
+
+typedef struct vnic_stats
+{
+    uint32_t tx_packets;                // Frames queued to the receiver, after the shaper if any
+    uint32_t tx_bytes;
+    uint32_t rx_packets;                // Frames read from this nic's queue
+    uint32_t rx_bytes;
+    uint32_t tx_drops[VNIC_DROP_MAX];   // Frames lost by vnic_transmit, by reason
+    uint32_t rx_drops[VNIC_DROP_MAX];   // Frames received but then lost by the consumer, by reason
+    uint32_t tx_queue_high_water;       // Max number of frames seen waiting in the receiver's queue
+} vnic_stats_t;
+
+// Timestamps travelling with a frame through the vnic queue, in esp_timer microseconds
+typedef struct vnic_meta
+{
+    int64_t origin_us;  // When the frame entered the node (simulator timestamp or lwIP output)
+    int64_t link_us;    // When the frame was read from the pysim link, 0 for outgoing frames
+    int64_t queued_us;  // When the frame was queued, filled by vnic_transmit_meta
+} vnic_meta_t;
+
 typedef struct vnic
 {
     struct vnic *next;
     QueueHandle_t rx_queue;
     void *esp_driver;
+    uint8_t id;
+
+    TickType_t tx_timeout;
+    portMUX_TYPE stats_lock;
+    vnic_stats_t stats;
+
+    struct vnic_shaper *shaper;         // NULL unless vnic_shaper_configure was called
 } vnic_t;
 
 // Initializes a new Virtual NIC instance
@@ -37,11 +76,16 @@ vnic_result_t vnic_create(vnic_t *self);
 // clear the transmission buffer.
 vnic_result_t vnic_bind_receiver(vnic_t *self, vnic_t *rx);
 
+// Sets how long vnic_transmit waits for room in the receiver's queue.
+//
+// Defaults to portMAX_DELAY, meaning transmissions never fail because of a full queue.
+void vnic_set_tx_timeout(vnic_t *self, TickType_t timeout);
+
 // Copies `buffer` to the TX buffer.
 //
 // This operation will do nothing if vnic_bind_receiver was not previously
-// called. If the transmission buffer is full because the receiver has not
-// read the information yet, this function will return an error.
+// called. If the transmission buffer is still full after the TX timeout because
+// the receiver has not read the information yet, this function will return an error.
 //
 // Buffer must be smaller than VNIC_MAX_LEN.
 //
@@ -51,6 +95,22 @@ vnic_result_t vnic_bind_receiver(vnic_t *self, vnic_t *rx);
 //  - NO_RECEIVER if no receiver has been bound to this nic
 vnic_result_t vnic_transmit(vnic_t *self, const uint8_t *buffer, size_t len);
 
+// Same as vnic_transmit, but `meta` is handed to the receiver along with the frame.
+//
+// `meta->queued_us` is overwritten with the time the frame was queued. `meta` may be NULL.
+vnic_result_t vnic_transmit_meta(vnic_t *self, const uint8_t *buffer, size_t len, const vnic_meta_t *meta);
+
+// Queues `frame`, obtained from ps_frame_alloc, to the receiver without copying it
+// and bypassing the shaper. `meta` is passed as is and may be NULL.
+//
+// On success the receiver owns the frame, on error it still belongs to the caller.
+// The frame is not traced or captured, vnic_transmit already did it.
+//
+// Errors returned:
+//  - NO_RECEIVER if no receiver has been bound to this nic
+//  - BUFFER_FULL if the receiver's queue is still full after `timeout` ticks
+vnic_result_t vnic_deliver_frame(vnic_t *self, uint8_t *frame, size_t len, const vnic_meta_t *meta, TickType_t timeout);
+
 // Waits for a new buffer to arrive.
 //
 // Buffer must be at least VNIC_MAX_LEN bytes big.
@@ -64,11 +124,59 @@ vnic_result_t vnic_transmit(vnic_t *self, const uint8_t *buffer, size_t len);
 //  - INVALID_PARAM if len < VNIC_MAX_LEN
 vnic_result_t vnic_receive(vnic_t *self, uint8_t *buffer, size_t buffer_sz, size_t *bytes_written);
 
+// Same as vnic_receive, also returning the metadata the frame was transmitted with.
+//
+// `meta` is zeroed if the frame was transmitted without metadata.
+vnic_result_t vnic_receive_meta(vnic_t *self, uint8_t *buffer, size_t buffer_sz, size_t *bytes_written, vnic_meta_t *meta);
+
+// Same as vnic_receive_meta, but gives up after `timeout` ticks. A timeout of 0 only
+// takes a frame that is already queued.
+//
+// Errors returned:
+//  - INVALID_PARAM if len < VNIC_MAX_LEN
+//  - TIMEOUT if no frame arrived in time
+vnic_result_t vnic_receive_timeout(vnic_t *self, uint8_t *buffer, size_t buffer_sz, size_t *bytes_written, vnic_meta_t *meta, TickType_t timeout);
+
+// Same as vnic_receive_timeout, but hands over the queued frame instead of copying it.
+//
+// The frame must be given back with vnic_release_frame, possibly from another task.
+//
+// Errors returned:
+//  - TIMEOUT if no frame arrived in time
+vnic_result_t vnic_receive_frame(vnic_t *self, uint8_t **frame, size_t *len, vnic_meta_t *meta, TickType_t timeout);
+
+// Frees a frame obtained with vnic_receive_frame.
+void vnic_release_frame(uint8_t *frame);
+
 // Deinits and cleans up any resource allocated by this VNIC.
 void vnic_destroy(vnic_t *self);
 
+// Accounts a frame that was read with vnic_receive but could not be delivered by the consumer.
+void vnic_count_rx_drop(vnic_t *self, vnic_drop_reason_t reason);
+
+// Accounts a frame that was given to vnic_transmit but never reached the receiver's queue.
+void vnic_count_tx_drop(vnic_t *self, vnic_drop_reason_t reason);
+
+// Copies the counters of this VNIC into `stats`.
+void vnic_get_stats(vnic_t *self, vnic_stats_t *stats);
+
+// Clears the counters of this VNIC.
+void vnic_reset_stats(vnic_t *self);
+
 // Register virtual nic within the ESP Netif subsystem so it can be used with lwIP.
 // vnic_result_t vnic_register_esp_netif(vnic_t *self, const char *if_key, const esp_netif_ip_info_t ip_config);
 vnic_result_t vnic_register_esp_netif(vnic_t *self, esp_netif_config_t config);
 
+// Same as vnic_register_esp_netif, with the task handing received frames to lwIP
+// pinned to `rx_core` instead of CONFIG_VNIC_RX_TASK_CORE.
+vnic_result_t vnic_register_esp_netif_on_core(vnic_t *self, esp_netif_config_t config, BaseType_t rx_core);
+
+// Sets which checksums lwIP computes and verifies on the netif of this VNIC, as a mask
+// of NETIF_CHECKSUM_* flags. Checksums left out must be handled by the other end.
+//
+// Errors returned:
+//  - INVALID_PARAM if the VNIC was not registered with vnic_register_esp_netif
+//  - NOT_SUPPORTED if lwIP was built without LWIP_CHECKSUM_CTRL_PER_NETIF
+vnic_result_t vnic_set_checksum_ctrl(vnic_t *self, uint16_t flags);
+
 #endif // _VIRTUAL_NIC_H_
\ No newline at end of file
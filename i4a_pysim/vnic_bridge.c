@@ -0,0 +1,263 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "vnic_bridge.h"
+
+#define ETH_HEADER_LEN 14
+#define TABLE_MASK (CONFIG_VNIC_BRIDGE_TABLE_SIZE - 1)
+#define MAX_PROBES 8
+
+#define IS_GROUP_ADDR(mac) ((mac)[0] & 0x01)
+
+_Static_assert((CONFIG_VNIC_BRIDGE_TABLE_SIZE & TABLE_MASK) == 0, "CONFIG_VNIC_BRIDGE_TABLE_SIZE must be a power of two");
+
+static void bridge_lock(vnic_bridge_t *self)
+{
+    while (!xSemaphoreTake(self->lock, portMAX_DELAY));
+}
+
+static void bridge_unlock(vnic_bridge_t *self)
+{
+    xSemaphoreGive(self->lock);
+}
+
+static size_t mac_hash(const uint8_t *mac)
+{
+    // Locally administered addresses share the first bytes, so the last ones carry the entropy
+    uint32_t h = (mac[2] << 24) | (mac[3] << 16) | (mac[4] << 8) | mac[5];
+    h ^= (mac[0] << 8) | mac[1];
+    h *= 0x9E3779B1;
+    return (h >> 16) & TABLE_MASK;
+}
+
+static bool is_stale(const vnic_bridge_t *self, const vnic_bridge_entry_t *entry, TickType_t now)
+{
+    return (now - entry->last_seen) > self->aging_ticks;
+}
+
+static bool is_local(const vnic_bridge_t *self, const uint8_t *mac)
+{
+    for (size_t i = 0; i < self->n_ports; i++)
+    {
+        if (memcmp(self->ports[i].local_mac, mac, VNIC_ETH_ADDR_LEN) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns the port `mac` was learned on, or -1 if unknown. Must be called with the lock held.
+static int table_lookup(vnic_bridge_t *self, const uint8_t *mac, TickType_t now)
+{
+    size_t slot = mac_hash(mac);
+    for (size_t i = 0; i < MAX_PROBES; i++, slot = (slot + 1) & TABLE_MASK)
+    {
+        vnic_bridge_entry_t *entry = &self->table[slot];
+        if (!entry->valid)
+        {
+            // Entries are never removed individually, so the probe sequence ends here
+            return -1;
+        }
+
+        if (memcmp(entry->mac, mac, VNIC_ETH_ADDR_LEN) == 0)
+        {
+            return is_stale(self, entry, now) ? -1 : entry->port;
+        }
+    }
+    return -1;
+}
+
+// Must be called with the lock held.
+static void table_learn(vnic_bridge_t *self, const uint8_t *mac, size_t port, TickType_t now)
+{
+    size_t slot = mac_hash(mac);
+    vnic_bridge_entry_t *candidate = NULL;
+
+    for (size_t i = 0; i < MAX_PROBES; i++, slot = (slot + 1) & TABLE_MASK)
+    {
+        vnic_bridge_entry_t *entry = &self->table[slot];
+        if (!entry->valid)
+        {
+            candidate = entry;
+            break;
+        }
+
+        if (memcmp(entry->mac, mac, VNIC_ETH_ADDR_LEN) == 0)
+        {
+            candidate = entry;
+            break;
+        }
+
+        // Prefer reusing an expired entry, otherwise evict the oldest one in the probe window
+        if (!candidate || (is_stale(self, entry, now) && !is_stale(self, candidate, now)) ||
+            (int32_t)(entry->last_seen - candidate->last_seen) < 0)
+        {
+            candidate = entry;
+        }
+    }
+
+    memcpy(candidate->mac, mac, VNIC_ETH_ADDR_LEN);
+    candidate->port = port;
+    candidate->valid = true;
+    candidate->last_seen = now;
+}
+
+// Sends `buffer` through `port`. Must be called without the lock held since it may block.
+static void port_transmit(vnic_bridge_t *self, size_t port, const uint8_t *buffer, size_t len)
+{
+    vnic_result_t err = vnic_transmit(self->ports[port].egress, buffer, len);
+
+    bridge_lock(self);
+    vnic_bridge_port_stats_t *stats = &self->ports[port].stats;
+    if (err == VNIC_OK)
+    {
+        stats->tx_packets++;
+        stats->tx_bytes += len;
+    }
+    else
+    {
+        stats->tx_errors++;
+    }
+    bridge_unlock(self);
+}
+
+vnic_result_t vnic_bridge_create(vnic_bridge_t *self, uint32_t aging_ms)
+{
+    memset(self, 0, sizeof(*self));
+    self->aging_ticks = pdMS_TO_TICKS(aging_ms);
+    self->lock = xSemaphoreCreateMutexStatic(&self->_st_lock);
+    if (!self->lock)
+    {
+        return VNIC_NO_MEMORY;
+    }
+    return VNIC_OK;
+}
+
+vnic_result_t vnic_bridge_add_port(vnic_bridge_t *self, vnic_t *egress, const uint8_t *local_mac, size_t *port)
+{
+    if (!egress || !local_mac)
+    {
+        return VNIC_INVALID_PARAM;
+    }
+
+    bridge_lock(self);
+    if (self->n_ports >= CONFIG_VNIC_BRIDGE_MAX_PORTS)
+    {
+        bridge_unlock(self);
+        return VNIC_INVALID_PARAM;
+    }
+
+    size_t id = self->n_ports++;
+    self->ports[id].egress = egress;
+    memcpy(self->ports[id].local_mac, local_mac, VNIC_ETH_ADDR_LEN);
+    bridge_unlock(self);
+
+    if (port)
+        *port = id;
+    return VNIC_OK;
+}
+
+void vnic_bridge_set_enabled(vnic_bridge_t *self, bool enabled)
+{
+    bridge_lock(self);
+    self->enabled = enabled;
+    bridge_unlock(self);
+}
+
+vnic_bridge_verdict_t vnic_bridge_input(vnic_bridge_t *self, size_t port, const uint8_t *buffer, size_t len)
+{
+    if (!self->enabled || port >= self->n_ports || len < ETH_HEADER_LEN)
+    {
+        return VNIC_BRIDGE_LOCAL;
+    }
+
+    const uint8_t *dst = buffer;
+    const uint8_t *src = buffer + VNIC_ETH_ADDR_LEN;
+    TickType_t now = xTaskGetTickCount();
+
+    bridge_lock(self);
+    vnic_bridge_port_stats_t *stats = &self->ports[port].stats;
+    stats->rx_packets++;
+    stats->rx_bytes += len;
+
+    if (!IS_GROUP_ADDR(src) && !is_local(self, src))
+    {
+        table_learn(self, src, port, now);
+    }
+
+    if (IS_GROUP_ADDR(dst))
+    {
+        stats->flooded_packets++;
+        stats->local_packets++;
+        bridge_unlock(self);
+
+        for (size_t i = 0; i < self->n_ports; i++)
+        {
+            if (i != port)
+                port_transmit(self, i, buffer, len);
+        }
+        return VNIC_BRIDGE_BOTH;
+    }
+
+    if (is_local(self, dst))
+    {
+        stats->local_packets++;
+        bridge_unlock(self);
+        return VNIC_BRIDGE_LOCAL;
+    }
+
+    int egress = table_lookup(self, dst, now);
+    if (egress == (int)port)
+    {
+        stats->filtered_packets++;
+        bridge_unlock(self);
+        return VNIC_BRIDGE_FILTERED;
+    }
+
+    if (egress < 0)
+    {
+        stats->flooded_packets++;
+    }
+    bridge_unlock(self);
+
+    if (egress >= 0)
+    {
+        port_transmit(self, egress, buffer, len);
+        return VNIC_BRIDGE_FORWARDED;
+    }
+
+    // Unknown unicast destination
+    for (size_t i = 0; i < self->n_ports; i++)
+    {
+        if (i != port)
+            port_transmit(self, i, buffer, len);
+    }
+    return VNIC_BRIDGE_FORWARDED;
+}
+
+void vnic_bridge_flush(vnic_bridge_t *self)
+{
+    bridge_lock(self);
+    memset(self->table, 0, sizeof(self->table));
+    bridge_unlock(self);
+}
+
+vnic_result_t vnic_bridge_get_port_stats(vnic_bridge_t *self, size_t port, vnic_bridge_port_stats_t *stats)
+{
+    if (!stats)
+    {
+        return VNIC_INVALID_PARAM;
+    }
+
+    bridge_lock(self);
+    if (port >= self->n_ports)
+    {
+        bridge_unlock(self);
+        return VNIC_INVALID_PARAM;
+    }
+    *stats = self->ports[port].stats;
+    bridge_unlock(self);
+    return VNIC_OK;
+}
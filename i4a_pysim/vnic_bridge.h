@@ -0,0 +1,96 @@
+#ifndef _VNIC_BRIDGE_H_
+#define _VNIC_BRIDGE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "virtual_nic.h"
+
+#define VNIC_ETH_ADDR_LEN 6
+
+typedef enum vnic_bridge_verdict
+{
+    VNIC_BRIDGE_LOCAL = 0,  // Frame must be delivered to the local stack only
+    VNIC_BRIDGE_FORWARDED,  // Frame was switched to other port(s), do not deliver locally
+    VNIC_BRIDGE_BOTH,       // Frame was switched and must also be delivered locally
+    VNIC_BRIDGE_FILTERED,   // Destination lives on the ingress port, frame must be dropped
+} vnic_bridge_verdict_t;
+
+typedef struct vnic_bridge_port_stats
+{
+    uint32_t rx_packets;        // Frames that entered the bridge through this port
+    uint32_t rx_bytes;
+    uint32_t tx_packets;        // Frames switched out of this port
+    uint32_t tx_bytes;
+    uint32_t local_packets;     // Frames received on this port and handed to the local stack
+    uint32_t flooded_packets;   // Frames received on this port and flooded
+    uint32_t filtered_packets;  // Frames received on this port whose destination lives on it
+    uint32_t tx_errors;         // Frames that could not be switched out of this port
+} vnic_bridge_port_stats_t;
+
+typedef struct vnic_bridge_entry
+{
+    uint8_t mac[VNIC_ETH_ADDR_LEN];
+    uint8_t port;
+    bool valid;
+    TickType_t last_seen;
+} vnic_bridge_entry_t;
+
+typedef struct vnic_bridge
+{
+    bool enabled;
+    TickType_t aging_ticks;
+
+    size_t n_ports;
+    struct
+    {
+        vnic_t *egress;
+        uint8_t local_mac[VNIC_ETH_ADDR_LEN];
+        vnic_bridge_port_stats_t stats;
+    } ports[CONFIG_VNIC_BRIDGE_MAX_PORTS];
+
+    vnic_bridge_entry_t table[CONFIG_VNIC_BRIDGE_TABLE_SIZE];
+
+    StaticSemaphore_t _st_lock;
+    SemaphoreHandle_t lock;
+} vnic_bridge_t;
+
+// Initializes a new, disabled, bridge with no ports.
+//
+// Learned entries that are not refreshed for `aging_ms` milliseconds are
+// forgotten.
+vnic_result_t vnic_bridge_create(vnic_bridge_t *self, uint32_t aging_ms);
+
+// Adds a new port to the bridge.
+//
+// Frames switched to this port are sent with `vnic_transmit(egress, ...)`.
+// Frames addressed to `local_mac` are never switched and belong to the local stack.
+//
+// Errors returned:
+//  - INVALID_PARAM if the bridge already has CONFIG_VNIC_BRIDGE_MAX_PORTS ports
+vnic_result_t vnic_bridge_add_port(vnic_bridge_t *self, vnic_t *egress, const uint8_t *local_mac, size_t *port);
+
+// Enables or disables switching. A disabled bridge hands every frame to the local stack.
+void vnic_bridge_set_enabled(vnic_bridge_t *self, bool enabled);
+
+// Processes a frame received from the outside on `port`.
+//
+// Learns the source address and, depending on the destination address, switches
+// the frame to the port where it was learned, floods it to every other port or
+// leaves it for the local stack. The caller must deliver the frame locally if
+// the verdict is LOCAL or BOTH.
+vnic_bridge_verdict_t vnic_bridge_input(vnic_bridge_t *self, size_t port, const uint8_t *buffer, size_t len);
+
+// Forgets every learned address.
+void vnic_bridge_flush(vnic_bridge_t *self);
+
+// Copies the counters of `port` into `stats`.
+//
+// Errors returned:
+//  - INVALID_PARAM if `port` does not exist
+vnic_result_t vnic_bridge_get_port_stats(vnic_bridge_t *self, size_t port, vnic_bridge_port_stats_t *stats);
+
+#endif // _VNIC_BRIDGE_H_
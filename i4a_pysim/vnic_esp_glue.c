@@ -1,19 +1,39 @@
 #include "lwip/esp_netif_net_stack.h"
 #include "lwip/esp_pbuf_ref.h"
 #include "netif/etharp.h"
+#include "lwip/snmp.h"
+#include "lwip/stats.h"
 #include "esp_netif_net_stack.h"
 #include "esp_netif.h"
 #include "esp_event.h"
 #include "esp_log.h"
 #include "virtual_nic.h"
+#include "pysim.h"
+#include "pysim_trace.h"
+#include "esp_timer.h"
+#include "frame_latency.h"
 
-#define TPP_TASK_STACK_SIZE 4096
+#if CONFIG_VNIC_RX_TASK_CORE < 0
+  #define VNIC_RX_TASK_CORE tskNO_AFFINITY
+#else
+  #define VNIC_RX_TASK_CORE CONFIG_VNIC_RX_TASK_CORE
+#endif
 
 #define IF_NAME(x) esp_netif_get_ifkey(esp_netif_get_handle_from_netif_impl(x))
 #define TAG "vnic"
 #define TAG_LWIP TAG "_lwip"
 #define TAG_ESPN TAG "_esp"
 
+#if CONFIG_VNIC_MIRROR_LWIP_STATS
+  #define VNIC_NETIF_STATS_ADD(netif, field, value) MIB2_STATS_NETIF_ADD(netif, field, value)
+  #define VNIC_NETIF_STATS_INC(netif, field) MIB2_STATS_NETIF_INC(netif, field)
+  #define VNIC_LINK_STATS_INC(field) LINK_STATS_INC(field)
+#else
+  #define VNIC_NETIF_STATS_ADD(netif, field, value)
+  #define VNIC_NETIF_STATS_INC(netif, field)
+  #define VNIC_LINK_STATS_INC(field)
+#endif
+
 #define VNIC_MAC_ADDR                      \
     {                                      \
         0xaa, 0x12, 0x34, 0x56, 0x78, 0x9a \
@@ -39,6 +59,7 @@ typedef struct vnic_driver
     // Custom fields
     vnic_t *vnic;
     esp_netif_t *vnic_netif;
+    BaseType_t rx_core;
 } vnic_driver_t;
 
 static err_t cb_lwip_output(struct netif *lwip_netif, struct pbuf *p, const ip4_addr_t *ipaddr) {
@@ -61,7 +82,7 @@ static esp_err_t cb_vnic_transmit(void *h, void *buffer, size_t len)
 
 static void cb_vnic_free_rx_buffer(void *h, void *buffer)
 {
-    free(buffer);
+    vnic_release_frame(buffer);
 }
 
 static void th_vnic_rx(void *h)
@@ -71,17 +92,24 @@ static void th_vnic_rx(void *h)
 
     while (true)
     {
-        uint8_t *buffer = malloc(VNIC_MAX_LEN);
-        if (!buffer)
+        // lwIP takes ownership of the queued frame and releases it through cb_vnic_free_rx_buffer
+        uint8_t *buffer;
+        size_t recvd = 0;
+        vnic_meta_t meta;
+        if (vnic_receive_frame(nic, &buffer, &recvd, &meta, portMAX_DELAY) != VNIC_OK)
         {
-            ESP_LOGE(TAG, "Could not allocate %u bytes for rx buffer", VNIC_MAX_LEN);
-            return;
+            continue;
         }
-        size_t recvd = 0;
-        vnic_result_t err;
-        if ((err = vnic_receive(nic, buffer, VNIC_MAX_LEN, &recvd)) != VNIC_OK)
+
+        if (frame_latency_enabled() && meta.origin_us)
         {
-            ESP_LOGE(TAG, "vnic_receive failed: %u", err);
+            int64_t dequeued_us = esp_timer_get_time();
+            ESP_ERROR_CHECK(esp_netif_receive(driver->vnic_netif, buffer, recvd, NULL));
+            int64_t done_us = esp_timer_get_time();
+
+            frame_latency_record(PS_LATENCY_RX_VNIC_QUEUE, meta.queued_us, dequeued_us);
+            frame_latency_record(PS_LATENCY_RX_LWIP, dequeued_us, done_us);
+            frame_latency_record(PS_LATENCY_RX_TOTAL, meta.origin_us, done_us);
             continue;
         }
 
@@ -91,10 +119,14 @@ static void th_vnic_rx(void *h)
 
 static void vnic_driver_start(void *h)
 {
-    if (xTaskCreate(th_vnic_rx, "th_vnic_rx", TPP_TASK_STACK_SIZE, h, (tskIDLE_PRIORITY + 2), NULL) != pdTRUE)
+    vnic_driver_t *driver = h;
+    TaskHandle_t task = NULL;
+    if (xTaskCreatePinnedToCore(th_vnic_rx, "th_vnic_rx", CONFIG_VNIC_RX_TASK_STACK_SIZE, h, CONFIG_VNIC_RX_TASK_PRIORITY, &task, driver->rx_core) != pdTRUE)
     {
         ESP_LOGE(TAG, "Failed to start receive task");
+        return;
     }
+    ps_mem_register_task(PS_MEM_VNIC, task, CONFIG_VNIC_RX_TASK_STACK_SIZE);
 }
 
 static esp_err_t cb_post_attach(esp_netif_t *esp_netif, void *args)
@@ -111,15 +143,21 @@ static esp_err_t cb_post_attach(esp_netif_t *esp_netif, void *args)
 }
 
 vnic_result_t vnic_register_esp_netif(vnic_t *self, esp_netif_config_t config)
+{
+    return vnic_register_esp_netif_on_core(self, config, VNIC_RX_TASK_CORE);
+}
+
+vnic_result_t vnic_register_esp_netif_on_core(vnic_t *self, esp_netif_config_t config, BaseType_t rx_core)
 {
     ESP_ERROR_CHECK(esp_netif_init());
     vnic_driver_t *driver = calloc(1, sizeof(vnic_driver_t));
-    driver->vnic = self;
     self->esp_driver = driver;
     if (!self->esp_driver)
     {
         return VNIC_NO_MEMORY;
     }
+    driver->vnic = self;
+    driver->rx_core = rx_core;
 
     const esp_netif_netstack_config_t netstack_config = {
         .lwip = {
@@ -144,6 +182,29 @@ vnic_result_t vnic_register_esp_netif(vnic_t *self, esp_netif_config_t config)
     return VNIC_OK;
 }
 
+vnic_result_t vnic_set_checksum_ctrl(vnic_t *self, uint16_t flags)
+{
+    vnic_driver_t *driver = self->esp_driver;
+    if (!driver)
+    {
+        return VNIC_INVALID_PARAM;
+    }
+
+#if LWIP_CHECKSUM_CTRL_PER_NETIF
+    struct netif *lwip_netif = esp_netif_get_netif_impl(driver->vnic_netif);
+    if (!lwip_netif)
+    {
+        return VNIC_INVALID_PARAM;
+    }
+
+    NETIF_SET_CHECKSUM_CTRL(lwip_netif, flags);
+    ESP_LOGI(IF_NAME(lwip_netif), "checksum ctrl 0x%04x", flags);
+    return VNIC_OK;
+#else
+    return VNIC_NOT_SUPPORTED;
+#endif
+}
+
 /********************* lwIP callbacks *********************/
 
 /// Callback for lwIP Initialization
@@ -183,19 +244,7 @@ static err_t cb_lwip_init(struct netif *lwip_netif)
 /// It should send it to the callback provided by lwIP at netif->input.
 static esp_netif_recv_ret_t cb_lwip_input(struct netif *lwip_netif, void *buffer, size_t len, void *eb)
 {
-    if (len >= 8)
-    {
-        uint8_t *b = buffer;
-        ESP_LOGD(IF_NAME(lwip_netif),
-                 "input([0x%02X, 0x%02X, 0x%02X, 0x%02X, 0x%02X, 0x%02X, 0x%02X, 0x%02X%s], len=%zu)",
-                 b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7],
-                 (len > 8) ? " ..." : "",
-                 len);
-    }
-    else
-    {
-        ESP_LOGD(TAG_LWIP, "input(buffer=%p, len=%zu)", buffer, len);
-    }
+    PS_TRACE(PS_TRACE_LWIP, lwip_netif->num, PS_TRACE_IN, buffer, len);
 
     esp_netif_t *esp_netif = esp_netif_get_handle_from_netif_impl(lwip_netif);
     if (!esp_netif)
@@ -207,10 +256,17 @@ static esp_netif_recv_ret_t cb_lwip_input(struct netif *lwip_netif, void *buffer
     struct pbuf *p = esp_pbuf_allocate(esp_netif, buffer, len, buffer);
     if (p == NULL)
     {
+        vnic_driver_t *driver = esp_netif_get_io_driver(esp_netif);
+        vnic_count_rx_drop(driver->vnic, VNIC_DROP_NO_MEMORY);
+        VNIC_NETIF_STATS_INC(lwip_netif, ifindiscards);
+        VNIC_LINK_STATS_INC(link.memerr);
         esp_netif_free_rx_buffer(esp_netif, buffer);
         return ESP_NETIF_OPTIONAL_RETURN_CODE(ESP_ERR_NO_MEM);
     }
 
+    VNIC_NETIF_STATS_ADD(lwip_netif, ifinoctets, len);
+    VNIC_LINK_STATS_INC(link.recv);
+
     if (!lwip_netif->input)
     {
         ESP_LOGE(TAG_LWIP, "No lwIP input callback. Has lwip_init been called before?");
@@ -230,27 +286,27 @@ static esp_netif_recv_ret_t cb_lwip_input(struct netif *lwip_netif, void *buffer
 
 static err_t cb_lwip_linkoutput(struct netif *lwip_netif, struct pbuf *p)
 {
-    if (p->len >= 8)
-    {
-        uint8_t *b = p->payload;
-        ESP_LOGD(TAG_LWIP,
-                 "linkoutput([0x%02X, 0x%02X, 0x%02X, 0x%02X, 0x%02X, 0x%02X, 0x%02X, 0x%02X%s], len=%zu)",
-                 b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7],
-                 (p->len > 8) ? " ..." : "",
-                 p->len);
-    }
-    else
-    {
-        ESP_LOGD(TAG_LWIP, "linkoutput(buffer=%p, len=%zu)", p->payload, p->len);
-    }
+    PS_TRACE(PS_TRACE_LWIP, lwip_netif->num, PS_TRACE_OUT, p->payload, p->len);
 
     esp_netif_t *esp_netif = esp_netif_get_handle_from_netif_impl(lwip_netif);
     vnic_driver_t *driver = esp_netif_get_io_driver(esp_netif);
     vnic_result_t err;
-    if ((err = vnic_transmit(driver->vnic, p->payload, p->len)) != VNIC_OK)
+    vnic_meta_t meta = {0};
+    if (frame_latency_enabled())
+    {
+        meta.origin_us = esp_timer_get_time();
+    }
+
+    if ((err = vnic_transmit_meta(driver->vnic, p->payload, p->len, meta.origin_us ? &meta : NULL)) != VNIC_OK)
     {
         ESP_LOGE(IF_NAME(lwip_netif), "vnic_transmit failed: %u", err);
+        VNIC_NETIF_STATS_INC(lwip_netif, ifoutdiscards);
+        VNIC_LINK_STATS_INC(link.drop);
+        return ERR_OK;
     }
 
+    VNIC_NETIF_STATS_ADD(lwip_netif, ifoutoctets, p->len);
+    VNIC_LINK_STATS_INC(link.xmit);
+
     return ERR_OK;
 }
\ No newline at end of file
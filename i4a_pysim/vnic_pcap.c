@@ -0,0 +1,172 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "vnic_pcap.h"
+#include "pysim.h"
+
+#if CONFIG_VNIC_PCAP
+
+#include "esp_timer.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <time.h>
+#else
+#include "esp_cpu.h"
+#endif
+
+#define RING_MASK (CONFIG_VNIC_PCAP_SLOTS - 1)
+
+_Static_assert((CONFIG_VNIC_PCAP_SLOTS & RING_MASK) == 0, "CONFIG_VNIC_PCAP_SLOTS must be a power of two");
+_Static_assert(CONFIG_VNIC_PCAP_MAX_SNAPLEN <= UINT16_MAX, "CONFIG_VNIC_PCAP_MAX_SNAPLEN must fit in a uint16_t");
+
+typedef struct slot
+{
+    uint32_t seq;  // Ring index + 1 once the record is complete, 0 while it is being written
+    vnic_pcap_record_t record;
+} slot_t;
+
+static struct
+{
+    bool enabled;
+    uint16_t snaplen;
+    uint32_t vnic_mask;
+
+    uint32_t head;  // Next slot to write, claimed atomically by producers
+    uint32_t tail;  // Next slot to read, only touched by the reader
+    slot_t *slots;
+
+    vnic_pcap_stats_t stats;
+} ring = {0};
+
+static uint32_t cost_now(void)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#else
+    return esp_cpu_get_cycle_count();
+#endif
+}
+
+vnic_result_t vnic_pcap_start(uint16_t snaplen, uint32_t vnic_mask)
+{
+    if (snaplen == 0 || snaplen > CONFIG_VNIC_PCAP_MAX_SNAPLEN)
+    {
+        return VNIC_INVALID_PARAM;
+    }
+
+    if (!ring.slots)
+    {
+        ring.slots = calloc(CONFIG_VNIC_PCAP_SLOTS, sizeof(slot_t));
+        if (!ring.slots)
+        {
+            return VNIC_NO_MEMORY;
+        }
+        ps_mem_add_static(PS_MEM_PCAP, CONFIG_VNIC_PCAP_SLOTS * sizeof(slot_t));
+    }
+
+    __atomic_store_n(&ring.enabled, false, __ATOMIC_RELEASE);
+    ring.snaplen = snaplen;
+    ring.vnic_mask = vnic_mask;
+    __atomic_store_n(&ring.enabled, true, __ATOMIC_RELEASE);
+    return VNIC_OK;
+}
+
+void vnic_pcap_stop(void)
+{
+    __atomic_store_n(&ring.enabled, false, __ATOMIC_RELEASE);
+}
+
+void vnic_pcap_capture(const vnic_t *self, const uint8_t *frame, size_t len)
+{
+    if (!__atomic_load_n(&ring.enabled, __ATOMIC_ACQUIRE) || self->id >= 32 || !(ring.vnic_mask & (1u << self->id)))
+    {
+        return;
+    }
+
+    uint32_t start = cost_now();
+    uint32_t index = __atomic_fetch_add(&ring.head, 1, __ATOMIC_RELAXED);
+    slot_t *slot = &ring.slots[index & RING_MASK];
+
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->record.vnic = self->id;
+    slot->record.len = len > UINT16_MAX ? UINT16_MAX : len;
+    slot->record.caplen = len < ring.snaplen ? len : ring.snaplen;
+    slot->record.timestamp_us = esp_timer_get_time();
+    memcpy(slot->record.data, frame, slot->record.caplen);
+
+    __atomic_store_n(&slot->seq, index + 1, __ATOMIC_RELEASE);
+
+    uint32_t cost = cost_now() - start;
+    __atomic_fetch_add(&ring.stats.captured, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ring.stats.cost_total, cost, __ATOMIC_RELAXED);
+    uint32_t max = __atomic_load_n(&ring.stats.cost_max, __ATOMIC_RELAXED);
+    while (cost > max && !__atomic_compare_exchange_n(&ring.stats.cost_max, &max, cost, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+bool vnic_pcap_next(vnic_pcap_record_t *record)
+{
+    if (!ring.slots)
+    {
+        return false;
+    }
+
+    while (1)
+    {
+        uint32_t head = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+        if (ring.tail == head)
+        {
+            return false;
+        }
+
+        // Producers lapped the reader
+        if (head - ring.tail > CONFIG_VNIC_PCAP_SLOTS)
+        {
+            __atomic_fetch_add(&ring.stats.overruns, head - CONFIG_VNIC_PCAP_SLOTS - ring.tail, __ATOMIC_RELAXED);
+            ring.tail = head - CONFIG_VNIC_PCAP_SLOTS;
+        }
+
+        uint32_t index = ring.tail;
+        slot_t *slot = &ring.slots[index & RING_MASK];
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == 0 || (int32_t)(seq - (index + 1)) < 0)
+        {
+            // Still being written, retry on the next call
+            return false;
+        }
+
+        ring.tail++;
+        if (seq != index + 1)
+        {
+            __atomic_fetch_add(&ring.stats.overruns, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        *record = slot->record;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        // Overwritten while copying
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != index + 1)
+        {
+            __atomic_fetch_add(&ring.stats.overruns, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        return true;
+    }
+}
+
+void vnic_pcap_get_stats(vnic_pcap_stats_t *stats)
+{
+    stats->captured = __atomic_load_n(&ring.stats.captured, __ATOMIC_RELAXED);
+    stats->overruns = __atomic_load_n(&ring.stats.overruns, __ATOMIC_RELAXED);
+    stats->cost_max = __atomic_load_n(&ring.stats.cost_max, __ATOMIC_RELAXED);
+    stats->cost_total = __atomic_load_n(&ring.stats.cost_total, __ATOMIC_RELAXED);
+}
+
+#endif // CONFIG_VNIC_PCAP
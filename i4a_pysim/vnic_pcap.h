@@ -0,0 +1,61 @@
+#ifndef _VNIC_PCAP_H_
+#define _VNIC_PCAP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "virtual_nic.h"
+
+typedef struct vnic_pcap_record
+{
+    uint8_t vnic;           // ID of the vnic that transmitted the frame
+    uint16_t caplen;        // Bytes stored in `data`
+    uint16_t len;           // Original frame length
+    int64_t timestamp_us;
+    uint8_t data[CONFIG_VNIC_PCAP_MAX_SNAPLEN];
+} vnic_pcap_record_t;
+
+typedef struct vnic_pcap_stats
+{
+    uint32_t captured;      // Frames copied into the ring
+    uint32_t overruns;      // Frames overwritten before vnic_pcap_next read them
+    uint32_t cost_max;      // Worst time spent in the capture hook, see `cost_total`
+    uint64_t cost_total;    // CPU cycles spent in the capture hook, nanoseconds on the linux target
+} vnic_pcap_stats_t;
+
+#if CONFIG_VNIC_PCAP
+
+// Starts copying the first `snaplen` bytes of every frame transmitted by a vnic
+// whose ID is set in `vnic_mask`. The ring is allocated on the first start and
+// never freed, the capture hook never blocks.
+//
+// Errors returned:
+//  - INVALID_PARAM if snaplen is 0 or above CONFIG_VNIC_PCAP_MAX_SNAPLEN
+//  - NO_MEMORY if the ring could not be allocated
+vnic_result_t vnic_pcap_start(uint16_t snaplen, uint32_t vnic_mask);
+
+// Stops capturing. Frames already in the ring can still be read.
+void vnic_pcap_stop(void);
+
+// Capture hook, called by vnic_transmit once the frame is queued.
+void vnic_pcap_capture(const vnic_t *self, const uint8_t *frame, size_t len);
+
+// Pops the oldest frame of the ring. Must be called from a single task.
+//
+// Returns false if the ring is empty.
+bool vnic_pcap_next(vnic_pcap_record_t *record);
+
+void vnic_pcap_get_stats(vnic_pcap_stats_t *stats);
+
+#else
+
+static inline vnic_result_t vnic_pcap_start(uint16_t snaplen, uint32_t vnic_mask) { return VNIC_INVALID_PARAM; }
+static inline void vnic_pcap_stop(void) { }
+static inline void vnic_pcap_capture(const vnic_t *self, const uint8_t *frame, size_t len) { }
+static inline bool vnic_pcap_next(vnic_pcap_record_t *record) { return false; }
+static inline void vnic_pcap_get_stats(vnic_pcap_stats_t *stats) { *stats = (vnic_pcap_stats_t){0}; }
+
+#endif // CONFIG_VNIC_PCAP
+
+#endif // _VNIC_PCAP_H_
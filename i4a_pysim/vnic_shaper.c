@@ -0,0 +1,389 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "vnic_shaper.h"
+#include "pysim.h"
+
+#if CONFIG_VNIC_SHAPER
+
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#if CONFIG_VNIC_SHAPER_TASK_CORE < 0
+  #define VNIC_SHAPER_TASK_CORE tskNO_AFFINITY
+#else
+  #define VNIC_SHAPER_TASK_CORE CONFIG_VNIC_SHAPER_TASK_CORE
+#endif
+
+#define TAG "vnic_shaper"
+
+// Tokens are kept in bit-microseconds: a frame costs len * 8 * 1e6 and every
+// elapsed microsecond adds rate_bps, which avoids dividing on the data path
+#define TOKENS_PER_BYTE (8 * 1000000LL)
+
+typedef struct entry
+{
+    uint8_t *data;
+    size_t len;
+    vnic_meta_t meta;
+    int64_t release_us;
+} entry_t;
+
+typedef struct vnic_shaper
+{
+    struct vnic_shaper *next;
+    vnic_t *vnic;
+
+    portMUX_TYPE lock;
+    bool enabled;
+    vnic_shaper_config_t config;
+    int64_t tokens;
+    int64_t refilled_us;
+
+    entry_t *ring;
+    uint32_t head;      // Next entry to deliver, only touched by the shaper task
+    uint32_t count;
+    vnic_shaper_stats_t stats;
+} vnic_shaper_t;
+
+static struct
+{
+    StaticSemaphore_t _st_lock;
+    SemaphoreHandle_t lock;     // Guards the list of shapers against the shaper task
+    TaskHandle_t task;
+    vnic_shaper_t *shapers;
+} shaping = {0};
+
+static portMUX_TYPE shaping_init_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Must be called with the shaper lock held
+static void refill(vnic_shaper_t *shaper, int64_t now)
+{
+    int64_t cap = (int64_t)shaper->config.burst_bytes * TOKENS_PER_BYTE;
+    int64_t elapsed_us = now - shaper->refilled_us;
+
+    // Keeps elapsed_us * rate_bps in range after long idle periods
+    if (elapsed_us > 1000000000LL)
+    {
+        elapsed_us = 1000000000LL;
+    }
+    shaper->tokens += elapsed_us * shaper->config.rate_bps;
+    if (shaper->tokens > cap)
+    {
+        shaper->tokens = cap;
+    }
+    shaper->refilled_us = now;
+}
+
+// Delivers every due frame of `shaper`, returns when the next one is due or
+// INT64_MAX if the queue is empty
+static int64_t shaper_run(vnic_shaper_t *shaper)
+{
+    while (1)
+    {
+        int64_t now = esp_timer_get_time();
+
+        portENTER_CRITICAL(&shaper->lock);
+        if (shaper->count == 0)
+        {
+            portEXIT_CRITICAL(&shaper->lock);
+            return INT64_MAX;
+        }
+
+        entry_t entry = shaper->ring[shaper->head];
+        int64_t cost = (int64_t)entry.len * TOKENS_PER_BYTE;
+        if (shaper->enabled)
+        {
+            if (entry.release_us > now)
+            {
+                portEXIT_CRITICAL(&shaper->lock);
+                return entry.release_us;
+            }
+
+            if (shaper->config.rate_bps)
+            {
+                refill(shaper, now);
+                if (shaper->tokens < cost)
+                {
+                    int64_t wait_us = (cost - shaper->tokens) / shaper->config.rate_bps + 1;
+                    shaper->stats.throttled++;
+                    portEXIT_CRITICAL(&shaper->lock);
+                    return now + wait_us;
+                }
+            }
+        }
+        portEXIT_CRITICAL(&shaper->lock);
+
+        // Never wait here, other shapers are served by the same task
+        vnic_result_t err = vnic_deliver_frame(shaper->vnic, entry.data, entry.len, &entry.meta, 0);
+        if (err == VNIC_BUFFER_FULL)
+        {
+            portENTER_CRITICAL(&shaper->lock);
+            shaper->stats.blocked++;
+            portEXIT_CRITICAL(&shaper->lock);
+            return now + 1;
+        }
+
+        if (err != VNIC_OK)
+        {
+            vnic_count_tx_drop(shaper->vnic, err == VNIC_NO_RECEIVER ? VNIC_DROP_NO_RECEIVER : VNIC_DROP_QUEUE_FULL);
+            ps_frame_free(entry.data);
+        }
+
+        portENTER_CRITICAL(&shaper->lock);
+        if (shaper->enabled && shaper->config.rate_bps)
+        {
+            shaper->tokens -= cost;
+        }
+        shaper->head = (shaper->head + 1) % CONFIG_VNIC_SHAPER_QUEUE_LEN;
+        shaper->count--;
+        if (err == VNIC_OK)
+        {
+            shaper->stats.delivered++;
+        }
+        portEXIT_CRITICAL(&shaper->lock);
+    }
+}
+
+static void shaper_task(void *arg)
+{
+    while (1)
+    {
+        int64_t next_us = INT64_MAX;
+
+        xSemaphoreTake(shaping.lock, portMAX_DELAY);
+        for (vnic_shaper_t *shaper = shaping.shapers; shaper; shaper = shaper->next)
+        {
+            int64_t due_us = shaper_run(shaper);
+            if (due_us < next_us)
+            {
+                next_us = due_us;
+            }
+        }
+        xSemaphoreGive(shaping.lock);
+
+        TickType_t wait = portMAX_DELAY;
+        if (next_us != INT64_MAX)
+        {
+            int64_t wait_us = next_us - esp_timer_get_time();
+            wait = wait_us <= 0 ? 1 : (TickType_t)((wait_us * configTICK_RATE_HZ + 999999) / 1000000);
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+static vnic_result_t shaping_init(void)
+{
+    portENTER_CRITICAL(&shaping_init_lock);
+    if (!shaping.lock)
+    {
+        shaping.lock = xSemaphoreCreateMutexStatic(&shaping._st_lock);
+    }
+    portEXIT_CRITICAL(&shaping_init_lock);
+
+    if (shaping.task)
+    {
+        return VNIC_OK;
+    }
+
+    TaskHandle_t task = NULL;
+    if (xTaskCreatePinnedToCore(shaper_task, "vnic_shaper", CONFIG_VNIC_SHAPER_TASK_STACK_SIZE, NULL, CONFIG_VNIC_SHAPER_TASK_PRIORITY, &task, VNIC_SHAPER_TASK_CORE) != pdTRUE)
+    {
+        ESP_LOGE(TAG, "Failed to start shaper task");
+        return VNIC_NO_MEMORY;
+    }
+    shaping.task = task;
+    ps_mem_register_task(PS_MEM_VNIC, task, CONFIG_VNIC_SHAPER_TASK_STACK_SIZE);
+    return VNIC_OK;
+}
+
+vnic_result_t vnic_shaper_configure(vnic_t *self, const vnic_shaper_config_t *config)
+{
+    if (!config)
+    {
+        return VNIC_INVALID_PARAM;
+    }
+
+    vnic_result_t err = shaping_init();
+    if (err != VNIC_OK)
+    {
+        return err;
+    }
+
+    xSemaphoreTake(shaping.lock, portMAX_DELAY);
+    vnic_shaper_t *shaper = self->shaper;
+    if (!shaper)
+    {
+        shaper = calloc(1, sizeof(vnic_shaper_t));
+        entry_t *ring = calloc(CONFIG_VNIC_SHAPER_QUEUE_LEN, sizeof(entry_t));
+        if (!shaper || !ring)
+        {
+            xSemaphoreGive(shaping.lock);
+            free(shaper);
+            free(ring);
+            return VNIC_NO_MEMORY;
+        }
+        ps_mem_add_static(PS_MEM_VNIC, sizeof(vnic_shaper_t) + CONFIG_VNIC_SHAPER_QUEUE_LEN * sizeof(entry_t));
+
+        portMUX_INITIALIZE(&shaper->lock);
+        shaper->vnic = self;
+        shaper->ring = ring;
+        shaper->next = shaping.shapers;
+        shaping.shapers = shaper;
+        self->shaper = shaper;
+    }
+
+    portENTER_CRITICAL(&shaper->lock);
+    shaper->config = *config;
+    if (shaper->config.burst_bytes < VNIC_MAX_LEN)
+    {
+        shaper->config.burst_bytes = VNIC_MAX_LEN;
+    }
+    if (shaper->config.queue_len == 0 || shaper->config.queue_len > CONFIG_VNIC_SHAPER_QUEUE_LEN)
+    {
+        shaper->config.queue_len = CONFIG_VNIC_SHAPER_QUEUE_LEN;
+    }
+    if (shaper->config.loss_ppm > 1000000)
+    {
+        shaper->config.loss_ppm = 1000000;
+    }
+    shaper->tokens = (int64_t)shaper->config.burst_bytes * TOKENS_PER_BYTE;
+    shaper->refilled_us = esp_timer_get_time();
+    shaper->enabled = true;
+    portEXIT_CRITICAL(&shaper->lock);
+    xSemaphoreGive(shaping.lock);
+
+    // Queued frames may be due earlier with the new parameters
+    xTaskNotifyGive(shaping.task);
+    return VNIC_OK;
+}
+
+void vnic_shaper_disable(vnic_t *self)
+{
+    vnic_shaper_t *shaper = self->shaper;
+    if (!shaper)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL(&shaper->lock);
+    shaper->enabled = false;
+    portEXIT_CRITICAL(&shaper->lock);
+    xTaskNotifyGive(shaping.task);
+}
+
+bool vnic_shaper_submit(vnic_t *self, uint8_t *frame, size_t len, const vnic_meta_t *meta, vnic_result_t *result)
+{
+    vnic_shaper_t *shaper = self->shaper;
+    if (!shaper || (!__atomic_load_n(&shaper->enabled, __ATOMIC_RELAXED) && !__atomic_load_n(&shaper->count, __ATOMIC_RELAXED)))
+    {
+        return false;
+    }
+
+    int64_t now = esp_timer_get_time();
+    uint32_t random = esp_random();
+
+    // Once disabled, frames keep queuing unshaped behind the ones still queued, until the
+    // shaper task delivered them all, so that the receiver gets them in order
+    portENTER_CRITICAL(&shaper->lock);
+    if (!shaper->enabled && shaper->count == 0)
+    {
+        portEXIT_CRITICAL(&shaper->lock);
+        return false;
+    }
+
+    const vnic_shaper_config_t *config = &shaper->config;
+    if (shaper->enabled && config->loss_ppm && random % 1000000 < config->loss_ppm)
+    {
+        shaper->stats.drop_loss++;
+        portEXIT_CRITICAL(&shaper->lock);
+        ps_frame_free(frame);
+        vnic_count_tx_drop(self, VNIC_DROP_LOSS);
+        *result = VNIC_OK;
+        return true;
+    }
+
+    if (shaper->count >= config->queue_len)
+    {
+        shaper->stats.drop_queue_full++;
+        portEXIT_CRITICAL(&shaper->lock);
+        ps_frame_free(frame);
+        vnic_count_tx_drop(self, VNIC_DROP_QUEUE_FULL);
+        *result = VNIC_BUFFER_FULL;
+        return true;
+    }
+
+    entry_t *entry = &shaper->ring[(shaper->head + shaper->count) % CONFIG_VNIC_SHAPER_QUEUE_LEN];
+    entry->data = frame;
+    entry->len = len;
+    entry->meta = meta ? *meta : (vnic_meta_t){0};
+    entry->release_us = shaper->enabled ? now + config->delay_us : now;
+    if (shaper->enabled && config->jitter_us)
+    {
+        entry->release_us += esp_random() % ((uint64_t)config->jitter_us + 1);
+    }
+
+    bool was_empty = shaper->count++ == 0;
+    shaper->stats.queued++;
+    if (shaper->count > shaper->stats.queue_high_water)
+    {
+        shaper->stats.queue_high_water = shaper->count;
+    }
+    portEXIT_CRITICAL(&shaper->lock);
+
+    // Otherwise the task already waits for the head of the queue
+    if (was_empty)
+    {
+        xTaskNotifyGive(shaping.task);
+    }
+    *result = VNIC_OK;
+    return true;
+}
+
+void vnic_shaper_get_stats(vnic_t *self, vnic_shaper_stats_t *stats)
+{
+    vnic_shaper_t *shaper = self->shaper;
+    if (!shaper)
+    {
+        *stats = (vnic_shaper_stats_t){0};
+        return;
+    }
+
+    portENTER_CRITICAL(&shaper->lock);
+    *stats = shaper->stats;
+    portEXIT_CRITICAL(&shaper->lock);
+}
+
+void vnic_shaper_destroy(vnic_t *self)
+{
+    vnic_shaper_t *shaper = self->shaper;
+    if (!shaper)
+    {
+        return;
+    }
+
+    xSemaphoreTake(shaping.lock, portMAX_DELAY);
+    for (vnic_shaper_t **it = &shaping.shapers; *it; it = &(*it)->next)
+    {
+        if (*it == shaper)
+        {
+            *it = shaper->next;
+            break;
+        }
+    }
+    self->shaper = NULL;
+    xSemaphoreGive(shaping.lock);
+
+    for (uint32_t i = 0; i < shaper->count; i++)
+    {
+        ps_frame_free(shaper->ring[(shaper->head + i) % CONFIG_VNIC_SHAPER_QUEUE_LEN].data);
+    }
+    free(shaper->ring);
+    free(shaper);
+}
+
+#endif // CONFIG_VNIC_SHAPER
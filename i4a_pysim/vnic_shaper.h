@@ -0,0 +1,73 @@
+#ifndef _VNIC_SHAPER_H_
+#define _VNIC_SHAPER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "virtual_nic.h"
+
+typedef struct vnic_shaper_config
+{
+    uint32_t rate_bps;      // Token bucket rate in bits per second, 0 for no rate limit
+    uint32_t burst_bytes;   // Bucket depth, raised to VNIC_MAX_LEN if smaller
+    uint32_t delay_us;      // Fixed delay added to every frame
+    uint32_t jitter_us;     // Upper bound of a uniformly distributed delay added on top of `delay_us`
+    uint32_t loss_ppm;      // Frames dropped at random, in parts per million
+    uint32_t queue_len;     // Frames held before new ones are dropped, 0 or above CONFIG_VNIC_SHAPER_QUEUE_LEN for the maximum
+} vnic_shaper_config_t;
+
+typedef struct vnic_shaper_stats
+{
+    uint32_t queued;            // Frames accepted by the shaper
+    uint32_t delivered;         // Frames handed to the receiver
+    uint32_t drop_loss;         // Frames dropped by the random loss
+    uint32_t drop_queue_full;   // Frames dropped because the shaper queue was full
+    uint32_t queue_high_water;  // Max number of frames seen waiting in the shaper
+    uint32_t throttled;         // Times the head frame had to wait for tokens
+    uint32_t blocked;           // Times the receiver's queue was full when a frame was due
+} vnic_shaper_stats_t;
+
+#if CONFIG_VNIC_SHAPER
+
+// Enables shaping on the frames transmitted by `self`, or updates its parameters.
+//
+// Shaped frames are copied by vnic_transmit into the shaper queue and never block
+// the sender. A single task hands them to the receiver once their delay expired
+// and the bucket holds enough tokens, in the order they were transmitted. Delays
+// are rounded up to the FreeRTOS tick. The queue is allocated on the first call
+// and kept until vnic_destroy.
+//
+// Errors returned:
+//  - NO_MEMORY if the queue or the shaper task could not be created
+vnic_result_t vnic_shaper_configure(vnic_t *self, const vnic_shaper_config_t *config);
+
+// Stops shaping frames transmitted by `self`. Frames still queued are delivered
+// right away, and frames transmitted before they all are queue behind them
+// unshaped, so the receiver gets every frame in the order it was transmitted.
+void vnic_shaper_disable(vnic_t *self);
+
+// Transmit hook, called by vnic_transmit with a frame obtained from ps_frame_alloc.
+//
+// Returns false if shaping is disabled: the frame still belongs to the caller.
+// Otherwise the shaper takes the frame and `result` receives the outcome. Frames
+// lost at random are reported as VNIC_OK, like a link that loses them in flight.
+bool vnic_shaper_submit(vnic_t *self, uint8_t *frame, size_t len, const vnic_meta_t *meta, vnic_result_t *result);
+
+// Copies the counters of the shaper of `self` into `stats`, zeroed if it was never configured.
+void vnic_shaper_get_stats(vnic_t *self, vnic_shaper_stats_t *stats);
+
+// Frees the shaper of `self`, called by vnic_destroy.
+void vnic_shaper_destroy(vnic_t *self);
+
+#else
+
+static inline vnic_result_t vnic_shaper_configure(vnic_t *self, const vnic_shaper_config_t *config) { return VNIC_NOT_SUPPORTED; }
+static inline void vnic_shaper_disable(vnic_t *self) { }
+static inline bool vnic_shaper_submit(vnic_t *self, uint8_t *frame, size_t len, const vnic_meta_t *meta, vnic_result_t *result) { return false; }
+static inline void vnic_shaper_get_stats(vnic_t *self, vnic_shaper_stats_t *stats) { *stats = (vnic_shaper_stats_t){0}; }
+static inline void vnic_shaper_destroy(vnic_t *self) { }
+
+#endif // CONFIG_VNIC_SHAPER
+
+#endif // _VNIC_SHAPER_H_
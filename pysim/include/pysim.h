@@ -5,20 +5,148 @@
 #error "PYSIM constant is not defined. Add -DPYSIM to compile options."
 #endif
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#include "sdkconfig.h"
 #include "esp_err.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
-#ifndef CONFIG_PYSIM_MAX_EVENTS
-  #define CONFIG_PYSIM_MAX_EVENTS 8
-#endif
-
+// `event_data` is shared by every subscriber of the event and only valid until the callback returns
 typedef void (*ps_event_callback_t)(uint8_t event_id, const void *event_data, size_t sz_event_data);
 
+// Adds `callback` to the subscribers of `event_id`, any 8-bit ID is valid.
+//
+// Subscribers run on the polling task in registration order and must not modify
+// `event_data`. Aborts if CONFIG_PYSIM_MAX_EVENT_SUBSCRIBERS are already registered.
 void ps_register_event(uint8_t event_id, ps_event_callback_t callback);
 void pysim_start();
 uint8_t ps_execute(uint8_t command, const void* args, size_t sz_args, void* ret, size_t *sz_ret);
 uint8_t ps_query(uint8_t command);
 
+/** -- stats -- */
+#define PS_HISTOGRAM_BUCKETS 16
+
+// Latency histogram in microseconds.
+//
+// Bucket `i` counts samples in [2^i, 2^(i+1)) us, bucket 0 also counts 0 us
+// samples and the last bucket counts everything above 2^15 us.
+typedef struct {
+    uint32_t buckets[PS_HISTOGRAM_BUCKETS];
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t sum_us;
+} ps_histogram_t;
+
+typedef struct {
+    uint32_t calls;
+    uint32_t errors;            // Calls that returned a status with PS_STATUS_MASK_ERROR set
+    uint64_t bytes_out;         // Arguments sent to the simulator
+    uint64_t bytes_in;          // Payload received from the simulator
+    ps_histogram_t lock_wait;   // Time spent waiting for the link locks
+    ps_histogram_t round_trip;  // Time between sending the command and reading the whole response
+} ps_command_stats_t;
+
+void ps_histogram_record(ps_histogram_t *histogram, uint32_t us);
+// Upper bound, in microseconds, of the bucket holding the `percentile`-th sample
+uint32_t ps_histogram_percentile(const ps_histogram_t *histogram, uint32_t percentile);
+
+// Returns ESP_ERR_NOT_FOUND if `command` was never executed since the last reset
+esp_err_t ps_stats_get_command(uint8_t command, ps_command_stats_t *stats);
+uint32_t ps_stats_get_event_count(uint8_t event_id);
+void ps_stats_reset(void);
+// Logs one line per executed command
+void ps_stats_log(void);
+/** -- stats -- */
+
+/** -- link profile -- */
+// Maximum payload of a single command
+#define PS_MAX_PAYLOAD_SIZE CONFIG_PYSIM_MAX_PAYLOAD_SIZE
+
+// Link characteristics measured with PS_CMD_ECHO and the parameters derived from them.
+typedef struct {
+    bool calibrated;        // False if the simulator does not answer PS_CMD_ECHO, the fields hold defaults
+    uint32_t generation;    // Incremented on every (re-)calibration
+    uint32_t rtt_us;        // Round trip of an empty command
+    uint32_t bytes_per_ms;  // Link throughput, counting both directions
+    uint32_t batch_bytes;   // Aggregate commands up to this size, fixed cost stays under CONFIG_PYSIM_BATCH_OVERHEAD_PCT
+    uint32_t flush_us;      // Longest worth waiting for a batch to fill
+} ps_link_profile_t;
+
+void ps_link_get_profile(ps_link_profile_t *profile);
+// Measures the link again. Blocks for CONFIG_PYSIM_CALIBRATION_ROUNDS echo round trips per payload size.
+esp_err_t ps_link_calibrate(void);
+/** -- link profile -- */
+
+/** -- capture -- */
+// Receives batches of the capture log. Returns the number of bytes written, less than `len` on error.
+typedef size_t (*ps_capture_write_t)(void *ctx, const void *data, size_t len);
+
+// Starts recording every command, response and event on the link into `write`.
+// See tools/pysim_controller.py --replay for the log format and its replay.
+//
+// Returns ESP_ERR_INVALID_STATE if pysim_start was not called or a capture is already running.
+esp_err_t ps_capture_start(ps_capture_write_t write, void *ctx);
+// Flushes the pending records and stops the capture
+void ps_capture_stop(void);
+
+#if CONFIG_IDF_TARGET_LINUX
+// Captures into a file, also started by pysim_start if PYSIM_CAPTURE names one
+esp_err_t ps_capture_start_file(const char *path);
+#endif
+/** -- capture -- */
+
+/** -- memory -- */
+typedef enum {
+    PS_MEM_LINK = 0,    // Polling task, event buffer, calibration and capture
+    PS_MEM_VNIC,        // Frames queued between vnics or held by lwIP, frame tasks
+    PS_MEM_SPI,         // SPI packets waiting for ps_spi_recv
+    PS_MEM_PCAP,        // pcap ring and streaming task
+    PS_MEM_MAX
+} ps_mem_subsystem_t;
+
+typedef struct {
+    uint32_t static_bytes;      // Buffers reserved for the lifetime of the node
+    uint32_t heap_bytes;        // Frames currently held plus their headers, see ps_frame_pool_get_stats for pool blocks
+    uint32_t heap_high_water;   // Max of heap_bytes since boot
+    uint32_t allocs;
+    uint32_t alloc_failures;    // Frames dropped because the heap or the pool was exhausted
+    uint32_t tasks;
+    uint32_t stack_bytes;       // Stack reserved by the subsystem's tasks
+    uint32_t stack_high_water;  // Stack those tasks ever used, summed
+} ps_mem_stats_t;
+
+typedef struct {
+    bool enabled;               // False if frames come from the heap
+    uint32_t block_size;
+    uint32_t blocks;
+    uint32_t reserved_blocks;   // Set aside by ps_mem_reserve, out of `blocks`
+    uint32_t free_blocks;
+    uint32_t min_free_blocks;   // Low-water mark of free_blocks, sizes CONFIG_PYSIM_FRAME_POOL_BUDGET
+} ps_frame_pool_stats_t;
+
+// Returns a frame buffer of `len` bytes accounted to `subsystem`, NULL if there is no room.
+//
+// Frames come from the shared pool if CONFIG_PYSIM_FRAME_POOL is set and from the
+// heap otherwise. Never blocks and may be called from any task.
+void *ps_frame_alloc(ps_mem_subsystem_t subsystem, size_t len);
+void ps_frame_free(void *frame);
+
+// Accounts `bytes` reserved for the lifetime of the node to `subsystem`
+void ps_mem_add_static(ps_mem_subsystem_t subsystem, size_t bytes);
+// Returns `bytes` reserved for the lifetime of the node and accounted to `subsystem`, NULL if
+// there is no room. With CONFIG_PYSIM_FRAME_POOL they are whole blocks carved off the pool,
+// so the area counts against the same budget as the frames, and must be reserved before the
+// first ps_frame_alloc. From the heap otherwise.
+void *ps_mem_reserve(ps_mem_subsystem_t subsystem, size_t bytes);
+// Tracks the stack high-water mark of `task`, created with `stack_size` bytes of stack
+void ps_mem_register_task(ps_mem_subsystem_t subsystem, TaskHandle_t task, uint32_t stack_size);
+
+esp_err_t ps_mem_get_stats(ps_mem_subsystem_t subsystem, ps_mem_stats_t *stats);
+void ps_frame_pool_get_stats(ps_frame_pool_stats_t *stats);
+// Logs one line per subsystem and one for the frame pool
+void ps_mem_log(void);
+/** -- memory -- */
+
 #endif // _PYSIM_H_
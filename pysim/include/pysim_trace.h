@@ -0,0 +1,54 @@
+#ifndef _PYSIM_TRACE_H_
+#define _PYSIM_TRACE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sdkconfig.h"
+
+// Binary trace ring shared by the pysim and vnic layers.
+//
+// Trace points are compiled out entirely unless CONFIG_PYSIM_TRACE is set.
+
+#define PS_TRACE_HEADER_LEN 16
+
+typedef enum {
+    PS_TRACE_LINK = 0,  // pysim link, `iface` is the command or event ID
+    PS_TRACE_VNIC,      // vnic queues, `iface` is the vnic ID
+    PS_TRACE_LWIP,      // lwIP netif, `iface` is the netif number
+} ps_trace_layer_t;
+
+typedef enum {
+    PS_TRACE_IN = 0,    // Event retrieved from the simulator, frame dequeued from a vnic or handed to lwIP
+    PS_TRACE_OUT,       // Command sent to the simulator, frame queued on a vnic or emitted by lwIP
+} ps_trace_dir_t;
+
+typedef struct {
+    uint32_t seq;           // Position in the ring + 1, 0 while the record is being written
+    uint32_t timestamp_us;
+    uint8_t layer;
+    uint8_t iface;
+    uint8_t dir;
+    uint8_t header_len;
+    uint16_t len;
+    uint8_t header[PS_TRACE_HEADER_LEN];
+} ps_trace_record_t;
+
+#if CONFIG_PYSIM_TRACE
+  #define PS_TRACE(layer, iface, dir, data, len) ps_trace_record((layer), (iface), (dir), (data), (len))
+#else
+  #define PS_TRACE(layer, iface, dir, data, len) do { } while (0)
+#endif
+
+// Appends a record to the ring. Lock-free, safe to call from any task.
+void ps_trace_record(uint8_t layer, uint8_t iface, uint8_t dir, const void *data, size_t len);
+
+// Copies up to `max` of the latest records into `out`, oldest first. Returns the number of records copied.
+size_t ps_trace_snapshot(ps_trace_record_t *out, size_t max);
+
+// Logs the contents of the ring, oldest first.
+void ps_trace_dump(void);
+
+void ps_trace_clear(void);
+
+#endif // _PYSIM_TRACE_H_
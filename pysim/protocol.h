@@ -5,6 +5,7 @@
 
 #define PS_CMD_LONG_POLL      0xF4
 #define PS_CMD_RETRIEVE_EVENT 0xF5
+#define PS_CMD_ECHO           0xF6  // Simulator answers with the same payload, used to calibrate the link
 
 #define PS_PACK_CMD(cmd, payload_len)   (((cmd) << 24) | (payload_len))
 #define PS_RESPONSE_LEN(response)       ((response) & 0x00FFFFFF)
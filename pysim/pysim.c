@@ -1,23 +1,51 @@
 #include "pysim.h"
 #include "esp_log.h"
 #include "esp_random.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
-#include "driver/uart.h"
+#include "freertos/semphr.h"
 #include "protocol.h"
-
-#define PS_UART_PORT UART_NUM_1
-#define PS_MAX_PAYLOAD_SIZE ((1600 * 2))
+#include "pysim_calibrate.h"
+#include "pysim_capture.h"
+#include "pysim_stats.h"
+#include "pysim_trace.h"
+#include "transport.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+  #define PS_TRANSPORT ps_transport_host
+#else
+  #define PS_TRANSPORT ps_transport_uart
+#endif
+
+#if CONFIG_PYSIM_POLLING_TASK_CORE < 0
+  #define PS_POLLING_TASK_CORE tskNO_AFFINITY
+#else
+  #define PS_POLLING_TASK_CORE CONFIG_PYSIM_POLLING_TASK_CORE
+#endif
 
 #define TAG "pysim"
 
 static struct {
     bool initialized;
+    const ps_transport_t *transport;
 
     StaticSemaphore_t _st_read_lock, _st_write_lock;
     SemaphoreHandle_t read_lock, write_lock;
-    ps_event_callback_t event_callbacks[CONFIG_PYSIM_MAX_EVENTS];
+
+    // Slot + 1 of the first subscriber to every event ID, 0 if it has none
+    uint8_t first_subscriber[256];
+    struct {
+        ps_event_callback_t callback;
+        uint8_t next;  // Slot + 1 of the next subscriber to the same event, 0 for the last one
+    } subscribers[CONFIG_PYSIM_MAX_EVENT_SUBSCRIBERS];
+    size_t n_subscribers;
 } self = { 0 };
 
+// Subscribers are only ever appended, so the polling task walks the lists without it
+static portMUX_TYPE subscribers_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint8_t event_buffer[CONFIG_PYSIM_EVENT_BUFFER_SIZE];
+
 static void uart_polling_task();
 
 void pysim_start() {
@@ -26,24 +54,33 @@ void pysim_start() {
         return;
     }
 
-    uart_config_t uart_config = {
-        .baud_rate = 115200,
-        .data_bits = UART_DATA_8_BITS,
-        .parity = UART_PARITY_DISABLE,
-        .stop_bits = UART_STOP_BITS_1,
-        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
-    };
-    ESP_ERROR_CHECK(uart_driver_install(PS_UART_PORT, 1600 * 2, 0, 0, NULL, 0));
-    ESP_ERROR_CHECK(uart_param_config(PS_UART_PORT, &uart_config));
+    self.transport = &PS_TRANSPORT;
+    ESP_ERROR_CHECK(self.transport->open());
     self.read_lock = xSemaphoreCreateMutexStatic(&self._st_read_lock);
     self.write_lock = xSemaphoreCreateMutexStatic(&self._st_write_lock);
+    ps_stats_init();
+    ps_capture_init();
 
-    xTaskCreatePinnedToCore(uart_polling_task, "uart_polling_task", 4096, NULL, 10, NULL, 1);
+    // No long poll is pending yet, so the echoes measure the link alone
+    ps_calibrate_init();
+
+    TaskHandle_t task = NULL;
+    xTaskCreatePinnedToCore(
+        uart_polling_task,
+        "uart_polling_task",
+        CONFIG_PYSIM_POLLING_TASK_STACK_SIZE,
+        NULL,
+        CONFIG_PYSIM_POLLING_TASK_PRIORITY,
+        &task,
+        PS_POLLING_TASK_CORE
+    );
+    ps_mem_register_task(PS_MEM_LINK, task, CONFIG_PYSIM_POLLING_TASK_STACK_SIZE);
+    ps_mem_add_static(PS_MEM_LINK, sizeof(event_buffer));
 }
 
 static void read_exact(void *buffer, uint32_t len)
 {
-    if (uart_read_bytes(PS_UART_PORT, buffer, len, portMAX_DELAY) != len)
+    if (self.transport->read(buffer, len) != len)
     {
         ESP_LOGE(TAG, "Received incomplete command from controller -- aborting");
         abort();
@@ -52,7 +89,7 @@ static void read_exact(void *buffer, uint32_t len)
 
 static void write_all(const void *buffer, uint32_t len)
 {
-    if (uart_write_bytes(PS_UART_PORT, buffer, len) != len)
+    if (self.transport->write(buffer, len) != len)
     {
         ESP_LOGE(TAG, "Wrote incomplete command to controller -- aborting");
         abort();
@@ -76,22 +113,34 @@ static void uart_read_unlock() {
     xSemaphoreGive(self.read_lock);
 }
 
-uint8_t ps_execute(uint8_t command, const void* args, size_t sz_args, void* resp, size_t *sz_resp) {
+// Timestamps are only taken for the stats, unless the caller asks for the round trip
+static inline int64_t link_now(bool timed) {
+    return timed ? esp_timer_get_time() : PS_STATS_NOW();
+}
+
+uint8_t ps_execute_timed(uint8_t command, const void* args, size_t sz_args, void* resp, size_t *sz_resp, int64_t *round_trip_us) {
     if (sz_args > 0xFFFFFF) {
         ESP_LOGE(TAG, "Maximum payload size is 0xFFFFFF");
         return 0xFE;
     }
 
     uint32_t payload = (command << 24) | sz_args;
+    bool timed = round_trip_us != NULL;
 
+    int64_t t_start = PS_STATS_NOW();
     uart_write_lock(); // Locks: write
-    
+    int64_t t_write_locked = link_now(timed);
+    PS_TRACE(PS_TRACE_LINK, command, PS_TRACE_OUT, args, sz_args);
+    ps_capture_record(PS_CAPTURE_COMMAND, command, args, sz_args);
+
     write_all(&payload, sizeof(uint32_t));
     if (sz_args > 0) {
         write_all(args, sz_args);
     }
 
+    int64_t t_sent = link_now(timed);
     uart_read_lock(); // Locks: write, read
+    int64_t t_read_locked = link_now(timed);
     
     uint32_t result = 0;
     read_exact(&result, sizeof(uint32_t));
@@ -111,12 +160,26 @@ uint8_t ps_execute(uint8_t command, const void* args, size_t sz_args, void* resp
     if (sz_resp) {
         *sz_resp = sz;
     }
+    ps_capture_record(command == PS_CMD_RETRIEVE_EVENT ? PS_CAPTURE_EVENT : PS_CAPTURE_RESPONSE, ret, resp, sz);
 
     uart_read_unlock(); // Locks: write
     uart_write_unlock(); // Locks: -
+
+    // Waiting for the read lock means waiting for a long poll to be released, which is not link time
+    int64_t read_lock_wait = t_read_locked - t_sent;
+    int64_t round_trip = link_now(timed) - t_write_locked - read_lock_wait;
+    ps_stats_record_command(command, ret, sz_args, sz, (t_write_locked - t_start) + read_lock_wait, round_trip);
+    ps_calibrate_observe(command, sz_args + sz, round_trip);
+    if (round_trip_us) {
+        *round_trip_us = round_trip;
+    }
     return ret;
 }
 
+uint8_t ps_execute(uint8_t command, const void* args, size_t sz_args, void* resp, size_t *sz_resp) {
+    return ps_execute_timed(command, args, sz_args, resp, sz_resp, NULL);
+}
+
 
 uint8_t ps_query(uint8_t cmd) {
     uint8_t ret = ps_execute(
@@ -135,31 +198,60 @@ uint8_t ps_query(uint8_t cmd) {
 }
 
 void ps_register_event(uint8_t event_id, ps_event_callback_t callback) {
-    if (event_id > CONFIG_PYSIM_MAX_EVENTS) {
+    portENTER_CRITICAL(&subscribers_lock);
+    if (self.n_subscribers >= CONFIG_PYSIM_MAX_EVENT_SUBSCRIBERS) {
+        portEXIT_CRITICAL(&subscribers_lock);
         ESP_LOGE(
-            TAG, 
-            "Trying to register handler for event ID=%u but max number of allowed events is %u -- check CONFIG_PYSIM_MAX_EVENTS", 
+            TAG,
+            "Trying to register handler for event ID=%u but all %u subscribers are taken -- check CONFIG_PYSIM_MAX_EVENT_SUBSCRIBERS",
             event_id,
-            CONFIG_PYSIM_MAX_EVENTS
+            CONFIG_PYSIM_MAX_EVENT_SUBSCRIBERS
         );
-        esp_system_abort("ps_register_event with invalid event id");
-    } else {
-        self.event_callbacks[event_id] = callback;
+        esp_system_abort("ps_register_event out of subscribers");
+    }
+
+    uint8_t slot = ++self.n_subscribers;
+    self.subscribers[slot - 1].callback = callback;
+    self.subscribers[slot - 1].next = 0;
+
+    uint8_t *link = &self.first_subscriber[event_id];
+    while (*link) {
+        link = &self.subscribers[*link - 1].next;
+    }
+    // Publishes the filled-in subscriber to a dispatch that may be running
+    __atomic_store_n(link, slot, __ATOMIC_RELEASE);
+    portEXIT_CRITICAL(&subscribers_lock);
+}
+
+static void dispatch_event(uint8_t event_id, const void *event_data, size_t sz_event_data) {
+    uint8_t slot = __atomic_load_n(&self.first_subscriber[event_id], __ATOMIC_ACQUIRE);
+    if (!slot) {
+        ESP_LOGW(TAG, "Got event ID=%u but no handler registered", event_id);
+        return;
+    }
+
+    while (slot) {
+        self.subscribers[slot - 1].callback(event_id, event_data, sz_event_data);
+        slot = __atomic_load_n(&self.subscribers[slot - 1].next, __ATOMIC_ACQUIRE);
     }
 }
 
 uint8_t uart_do_long_poll() {
+    int64_t t_start = PS_STATS_NOW();
     uart_write_lock(); // Locks: -
     uart_read_lock();  // Locks: write
+    int64_t t_locked = PS_STATS_NOW();
 
     // Enter long polling
     uint32_t cmd = PS_PACK_CMD(PS_CMD_LONG_POLL, 0);
     write_all(&cmd, sizeof(uint32_t));  // Locks: write, read
+    ps_capture_record(PS_CAPTURE_COMMAND, PS_CMD_LONG_POLL, NULL, 0);
     
     uart_write_unlock();    // Release write lock
 
     uint32_t result = 0;
     read_exact(&result, sizeof(uint32_t));
+    ps_capture_record(PS_CAPTURE_RESPONSE, PS_RESPONSE_STATUS(result), NULL, 0);
     uart_read_unlock();  // Got data, release read lock
 
     if (PS_RESPONSE_LEN(result) != 0) {
@@ -167,12 +259,13 @@ uint8_t uart_do_long_poll() {
         abort();
     }
 
+    ps_stats_record_command(PS_CMD_LONG_POLL, PS_RESPONSE_STATUS(result), 0, 0, t_locked - t_start, PS_STATS_NOW() - t_locked);
+
     return PS_RESPONSE_STATUS(result);
 }
 
 static void uart_polling_task() {
-    static uint8_t event_buffer[1600];
-    size_t event_buffer_sz = 1600;
+    size_t event_buffer_sz = sizeof(event_buffer);
 
     while (1) {
         uint8_t ret = uart_do_long_poll();
@@ -183,27 +276,15 @@ static void uart_polling_task() {
 
         // There are pending events
         event_buffer_sz = sizeof(event_buffer);
-        ret = ps_execute(0xF5, NULL, 0, event_buffer, &event_buffer_sz);
+        ret = ps_execute(PS_CMD_RETRIEVE_EVENT, NULL, 0, event_buffer, &event_buffer_sz);
 
         if (PS_IS_ERROR(ret)) {
             ESP_LOGE(TAG, "PySIM failed to retrieve event!! err=%u", ret);
             esp_system_abort("PySIM failed to retrieve an event");
         } else {
-            if (ret > CONFIG_PYSIM_MAX_EVENTS) {
-                ESP_LOGE(
-                    TAG, 
-                    "Got event ID=%u but max number of allowed events is %u -- check CONFIG_PYSIM_MAX_EVENTS", 
-                    ret,
-                    CONFIG_PYSIM_MAX_EVENTS
-                );
-                continue;
-            }
-
-            if (self.event_callbacks[ret]) {
-                self.event_callbacks[ret](ret, event_buffer, event_buffer_sz);
-            } else {
-                ESP_LOGW(TAG, "Got event ID=%u but no handler registered");
-            }
+            ps_stats_record_event(ret);
+            PS_TRACE(PS_TRACE_LINK, ret, PS_TRACE_IN, event_buffer, event_buffer_sz);
+            dispatch_event(ret, event_buffer, event_buffer_sz);
         }
         
         
@@ -0,0 +1,189 @@
+#include <string.h>
+#include <inttypes.h>
+
+#include "pysim.h"
+#include "pysim_calibrate.h"
+#include "protocol.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define TAG "pysim_calibrate"
+
+#if CONFIG_PYSIM_RETUNE_TASK_CORE < 0
+  #define PS_RETUNE_TASK_CORE tskNO_AFFINITY
+#else
+  #define PS_RETUNE_TASK_CORE CONFIG_PYSIM_RETUNE_TASK_CORE
+#endif
+
+// Used until the link is calibrated, or if the simulator does not support PS_CMD_ECHO
+#define DEFAULT_RTT_US       1000
+#define DEFAULT_BYTES_PER_MS 11     // 115200 baud
+
+#define MAX_ECHO_SIZE 1024
+
+static const uint32_t payload_sizes[] = { 0, 64, 256, MAX_ECHO_SIZE };
+
+_Static_assert(MAX_ECHO_SIZE <= PS_MAX_PAYLOAD_SIZE, "the largest echo must fit in a single command");
+
+static struct {
+    portMUX_TYPE lock;
+    ps_link_profile_t profile;
+
+    // Fixed cost of the regular commands, in 1/16 us, exponentially averaged
+    uint32_t observed_rtt_x16;
+    uint32_t observed_samples;
+} cal = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+static uint32_t clamp_u32(uint64_t value, uint32_t min, uint32_t max) {
+    return value < min ? min : (value > max ? max : (uint32_t)value);
+}
+
+// Derives the batching parameters from the fixed cost and throughput of the link
+static void derive_profile(ps_link_profile_t *profile, uint32_t rtt_us, uint32_t bytes_per_ms) {
+    profile->rtt_us = rtt_us;
+    profile->bytes_per_ms = bytes_per_ms;
+
+    // rtt / (rtt + batch / throughput) <= overhead
+    uint64_t batch = (uint64_t)rtt_us * bytes_per_ms * (100 - CONFIG_PYSIM_BATCH_OVERHEAD_PCT) / (CONFIG_PYSIM_BATCH_OVERHEAD_PCT * 1000ULL);
+    profile->batch_bytes = clamp_u32(batch, 1600, PS_MAX_PAYLOAD_SIZE);
+
+    // Waiting longer than a round trip costs more than sending a smaller batch
+    profile->flush_us = rtt_us;
+}
+
+// Fastest of CONFIG_PYSIM_CALIBRATION_ROUNDS echoes, or -1 if the simulator does not support them
+static int64_t measure_echo(uint32_t size) {
+    static uint8_t payload[MAX_ECHO_SIZE], response[MAX_ECHO_SIZE];
+    int64_t best = INT64_MAX;
+
+    memset(payload, 0x5A, size);
+    for (size_t i = 0; i < CONFIG_PYSIM_CALIBRATION_ROUNDS; i++) {
+        // Measured like ps_calibrate_observe, so retune_task compares like with like
+        size_t sz_response = sizeof(response);
+        int64_t elapsed;
+        uint8_t ret = ps_execute_timed(PS_CMD_ECHO, payload, size, response, &sz_response, &elapsed);
+
+        if (ret != 0 || sz_response != size) {
+            return -1;
+        }
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+esp_err_t ps_link_calibrate(void) {
+    int64_t rtt[sizeof(payload_sizes) / sizeof(payload_sizes[0])];
+    for (size_t i = 0; i < sizeof(payload_sizes) / sizeof(payload_sizes[0]); i++) {
+        if ((rtt[i] = measure_echo(payload_sizes[i])) < 0) {
+            ESP_LOGW(TAG, "simulator does not support echo -- keeping defaults");
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+    }
+
+    // Echo moves the payload both ways: t(size) = rtt + 2 * size / throughput
+    size_t last = sizeof(payload_sizes) / sizeof(payload_sizes[0]) - 1;
+    int64_t per_payload = rtt[last] - rtt[0];
+    uint32_t bytes_per_ms = per_payload > 0 ? clamp_u32(2000ULL * payload_sizes[last] / per_payload, 1, UINT32_MAX) : UINT32_MAX;
+    uint32_t rtt_us = clamp_u32(rtt[0], 1, UINT32_MAX);
+
+    ps_link_profile_t profile = { .calibrated = true };
+    derive_profile(&profile, rtt_us, bytes_per_ms);
+
+    portENTER_CRITICAL(&cal.lock);
+    profile.generation = cal.profile.generation + 1;
+    cal.profile = profile;
+    cal.observed_rtt_x16 = rtt_us * 16;
+    cal.observed_samples = 0;
+    portEXIT_CRITICAL(&cal.lock);
+
+    ESP_LOGI(
+        TAG,
+        "rtt=%" PRIu32 "us throughput=%" PRIu32 "B/ms -> batch=%" PRIu32 "B flush=%" PRIu32 "us",
+        profile.rtt_us, profile.bytes_per_ms, profile.batch_bytes, profile.flush_us
+    );
+    return ESP_OK;
+}
+
+void ps_link_get_profile(ps_link_profile_t *profile) {
+    portENTER_CRITICAL(&cal.lock);
+    *profile = cal.profile;
+    portEXIT_CRITICAL(&cal.lock);
+}
+
+#if CONFIG_PYSIM_CALIBRATE && CONFIG_PYSIM_STATS && CONFIG_PYSIM_RETUNE_PERIOD_MS
+
+void ps_calibrate_observe(uint8_t command, uint32_t bytes, int64_t round_trip_us) {
+    if (command == PS_CMD_ECHO || round_trip_us <= 0) {
+        return;
+    }
+
+    portENTER_CRITICAL(&cal.lock);
+    if (cal.profile.calibrated) {
+        // Remove the transfer time so frames of any size estimate the same fixed cost
+        int64_t transfer_us = cal.profile.bytes_per_ms ? (int64_t)bytes * 1000 / cal.profile.bytes_per_ms : 0;
+        int64_t fixed_us = round_trip_us > transfer_us ? round_trip_us - transfer_us : 0;
+        uint32_t sample_x16 = clamp_u32(fixed_us * 16, 0, UINT32_MAX / 2);
+
+        // alpha = 1/16
+        cal.observed_rtt_x16 = cal.observed_rtt_x16 - cal.observed_rtt_x16 / 16 + sample_x16 / 16;
+        cal.observed_samples++;
+    }
+    portEXIT_CRITICAL(&cal.lock);
+}
+
+static void retune_task(void *arg) {
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_PYSIM_RETUNE_PERIOD_MS));
+
+        portENTER_CRITICAL(&cal.lock);
+        uint32_t expected = cal.profile.rtt_us;
+        uint32_t observed = cal.observed_rtt_x16 / 16;
+        bool enough = cal.observed_samples >= 16;
+        portEXIT_CRITICAL(&cal.lock);
+
+        uint32_t drift = observed > expected ? observed - expected : expected - observed;
+        if (enough && (uint64_t)drift * 100 > (uint64_t)expected * CONFIG_PYSIM_RETUNE_DRIFT_PCT) {
+            ESP_LOGI(TAG, "round trip drifted from %" PRIu32 "us to %" PRIu32 "us -- recalibrating", expected, observed);
+            ps_link_calibrate();
+        }
+    }
+}
+
+#endif
+
+void ps_calibrate_init(void) {
+    ps_link_profile_t defaults = { 0 };
+    derive_profile(&defaults, DEFAULT_RTT_US, DEFAULT_BYTES_PER_MS);
+
+    portENTER_CRITICAL(&cal.lock);
+    cal.profile = defaults;
+    portEXIT_CRITICAL(&cal.lock);
+
+#if CONFIG_PYSIM_CALIBRATE
+    // Echo payload and response buffers of measure_echo
+    ps_mem_add_static(PS_MEM_LINK, 2 * MAX_ECHO_SIZE);
+    if (ps_link_calibrate() != ESP_OK) {
+        return;
+    }
+
+#if CONFIG_PYSIM_STATS && CONFIG_PYSIM_RETUNE_PERIOD_MS
+    TaskHandle_t task = NULL;
+    xTaskCreatePinnedToCore(
+        retune_task,
+        "ps_retune",
+        CONFIG_PYSIM_RETUNE_TASK_STACK_SIZE,
+        NULL,
+        CONFIG_PYSIM_RETUNE_TASK_PRIORITY,
+        &task,
+        PS_RETUNE_TASK_CORE
+    );
+    ps_mem_register_task(PS_MEM_LINK, task, CONFIG_PYSIM_RETUNE_TASK_STACK_SIZE);
+#endif
+#endif
+}
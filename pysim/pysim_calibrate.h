@@ -0,0 +1,27 @@
+#ifndef _PYSIM_CALIBRATE_H_
+#define _PYSIM_CALIBRATE_H_
+
+#include <stdint.h>
+
+#include "pysim.h"
+
+// Calibrates the link, must be called before the polling task starts
+void ps_calibrate_init(void);
+
+// ps_execute that also stores in `round_trip_us` the time the command spent on the link, the
+// one ps_calibrate_observe sees: the wait for a pending long poll to be released is left out.
+// Defined in pysim.c.
+uint8_t ps_execute_timed(uint8_t command, const void *args, size_t sz_args, void *resp, size_t *sz_resp, int64_t *round_trip_us);
+
+#if CONFIG_PYSIM_CALIBRATE && CONFIG_PYSIM_STATS && CONFIG_PYSIM_RETUNE_PERIOD_MS
+
+// Feeds the drift detector with the round trip of a regular command
+void ps_calibrate_observe(uint8_t command, uint32_t bytes, int64_t round_trip_us);
+
+#else
+
+static inline void ps_calibrate_observe(uint8_t command, uint32_t bytes, int64_t round_trip_us) { }
+
+#endif
+
+#endif // _PYSIM_CALIBRATE_H_
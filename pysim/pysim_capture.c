@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pysim.h"
+#include "pysim_capture.h"
+#include "protocol.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#define TAG "pysim_capture"
+
+#if CONFIG_PYSIM_CAPTURE
+
+static struct {
+    // Read without the lock on the link path, records may be lost around start/stop
+    volatile bool active;
+    ps_capture_write_t write;
+    void (*close)(void *ctx);
+    void *ctx;
+    int64_t last_us;
+
+    uint8_t buffer[CONFIG_PYSIM_CAPTURE_BUFFER_SIZE];
+    size_t used;
+
+    StaticSemaphore_t _st_lock;
+    SemaphoreHandle_t lock;
+} capture = { 0 };
+
+static void capture_lock(void) {
+    while (!xSemaphoreTake(capture.lock, portMAX_DELAY));
+}
+
+static void capture_unlock(void) {
+    xSemaphoreGive(capture.lock);
+}
+
+// Must be called with the lock held
+static void capture_flush(void) {
+    if (capture.used > 0 && capture.write(capture.ctx, capture.buffer, capture.used) != capture.used) {
+        ESP_LOGE(TAG, "capture sink failed -- stopping capture");
+        capture.active = false;
+    }
+    capture.used = 0;
+}
+
+// Must be called with the lock held
+static void capture_append(const void *data, size_t len) {
+    const uint8_t *bytes = data;
+    while (len > 0 && capture.active) {
+        if (capture.used == sizeof(capture.buffer)) {
+            capture_flush();
+        }
+
+        size_t chunk = sizeof(capture.buffer) - capture.used;
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(capture.buffer + capture.used, bytes, chunk);
+        capture.used += chunk;
+        bytes += chunk;
+        len -= chunk;
+    }
+}
+
+void ps_capture_init(void) {
+    if (!capture.lock) {
+        capture.lock = xSemaphoreCreateMutexStatic(&capture._st_lock);
+        ps_mem_add_static(PS_MEM_LINK, sizeof(capture.buffer));
+    }
+
+#if CONFIG_IDF_TARGET_LINUX
+    const char *path = getenv("PYSIM_CAPTURE");
+    if (path && ps_capture_start_file(path) != ESP_OK) {
+        ESP_LOGE(TAG, "could not capture the link to %s", path);
+    }
+#endif
+}
+
+void ps_capture_record(ps_capture_kind_t kind, uint8_t code, const void *data, size_t len) {
+    if (!capture.active) {
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+
+    capture_lock();
+    int64_t delta = now - capture.last_us;
+    capture.last_us = now;
+
+    ps_capture_record_t record = {
+        .delta_us = delta < 0 ? 0 : (delta > UINT32_MAX ? UINT32_MAX : (uint32_t)delta),
+        .kind = kind,
+        .header = PS_PACK_CMD((uint32_t)code, (uint32_t)len),
+    };
+    capture_append(&record, sizeof(record));
+    capture_append(data, len);
+    capture_unlock();
+}
+
+esp_err_t ps_capture_start(ps_capture_write_t write, void *ctx) {
+    if (!write) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!capture.lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    capture_lock();
+    if (capture.active) {
+        capture_unlock();
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    capture.write = write;
+    capture.close = NULL;
+    capture.ctx = ctx;
+    capture.used = 0;
+    capture.last_us = esp_timer_get_time();
+    capture.active = true;
+
+    ps_capture_file_header_t header = {
+        .magic = PS_CAPTURE_MAGIC,
+        .version = PS_CAPTURE_VERSION,
+    };
+    capture_append(&header, sizeof(header));
+    capture_unlock();
+    return ESP_OK;
+}
+
+void ps_capture_stop(void) {
+    if (!capture.lock) {
+        return;
+    }
+
+    capture_lock();
+    if (capture.active) {
+        capture_flush();
+        capture.active = false;
+    }
+    if (capture.close) {
+        capture.close(capture.ctx);
+        capture.close = NULL;
+    }
+    capture_unlock();
+}
+
+#if CONFIG_IDF_TARGET_LINUX
+
+static size_t file_write(void *ctx, const void *data, size_t len) {
+    FILE *file = ctx;
+    size_t written = fwrite(data, 1, len, file);
+    fflush(file);
+    return written;
+}
+
+static void file_close(void *ctx) {
+    fclose(ctx);
+}
+
+esp_err_t ps_capture_start_file(const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return ESP_FAIL;
+    }
+
+    esp_err_t err = ps_capture_start(file_write, file);
+    if (err != ESP_OK) {
+        fclose(file);
+        return err;
+    }
+
+    capture_lock();
+    capture.close = file_close;
+    capture_unlock();
+
+    ESP_LOGI(TAG, "capturing the link to %s", path);
+    return ESP_OK;
+}
+
+#endif // CONFIG_IDF_TARGET_LINUX
+
+#else
+
+esp_err_t ps_capture_start(ps_capture_write_t write, void *ctx) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void ps_capture_stop(void) {
+}
+
+#if CONFIG_IDF_TARGET_LINUX
+esp_err_t ps_capture_start_file(const char *path) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+#endif
+
+#endif // CONFIG_PYSIM_CAPTURE
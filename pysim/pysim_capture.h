@@ -0,0 +1,45 @@
+#ifndef _PYSIM_CAPTURE_H_
+#define _PYSIM_CAPTURE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "pysim.h"
+
+#define PS_CAPTURE_MAGIC   "PSCP"
+#define PS_CAPTURE_VERSION 1
+
+// File layout: a ps_capture_file_header_t followed by records. Every record is
+// a ps_capture_record_t followed by `PS_RESPONSE_LEN(header)` payload bytes.
+// All fields are little endian.
+typedef struct __attribute__((packed)) {
+    char magic[4];
+    uint16_t version;
+    uint16_t reserved;
+} ps_capture_file_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t delta_us;  // Time since the previous record, saturated
+    uint8_t kind;       // ps_capture_kind_t
+    uint32_t header;    // Link framing: (command, status or event ID << 24) | payload length
+} ps_capture_record_t;
+
+typedef enum {
+    PS_CAPTURE_COMMAND = 0,  // Command sent to the simulator, payload holds the arguments
+    PS_CAPTURE_RESPONSE,     // Response read from the simulator, including long poll releases
+    PS_CAPTURE_EVENT,        // Event retrieved with PS_CMD_RETRIEVE_EVENT, replaces its response
+} ps_capture_kind_t;
+
+#if CONFIG_PYSIM_CAPTURE
+
+void ps_capture_init(void);
+void ps_capture_record(ps_capture_kind_t kind, uint8_t code, const void *data, size_t len);
+
+#else
+
+static inline void ps_capture_init(void) { }
+static inline void ps_capture_record(ps_capture_kind_t kind, uint8_t code, const void *data, size_t len) { }
+
+#endif // CONFIG_PYSIM_CAPTURE
+
+#endif // _PYSIM_CAPTURE_H_
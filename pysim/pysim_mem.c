@@ -0,0 +1,265 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "pysim.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define TAG "pysim_mem"
+
+// Precedes every frame, whether it comes from the pool or the heap
+typedef struct frame_header {
+    struct frame_header *next_free;
+    uint32_t size;      // Bytes accounted to the subsystem, header included, the same with or without the pool
+    uint8_t subsystem;
+} __attribute__((aligned(8))) frame_header_t;
+
+#if CONFIG_PYSIM_FRAME_POOL
+  #define POOL_STRIDE ((sizeof(frame_header_t) + CONFIG_PYSIM_FRAME_POOL_BLOCK_SIZE + 7) & ~7)
+  #define POOL_BLOCKS (CONFIG_PYSIM_FRAME_POOL_BUDGET / POOL_STRIDE)
+
+_Static_assert(POOL_BLOCKS > 0, "CONFIG_PYSIM_FRAME_POOL_BUDGET must hold at least one block");
+#endif
+
+static struct {
+    portMUX_TYPE lock;
+    ps_mem_stats_t subsystems[PS_MEM_MAX];
+
+    struct {
+        TaskHandle_t handle;
+        uint32_t stack_size;
+        ps_mem_subsystem_t subsystem;
+    } tasks[CONFIG_PYSIM_MEM_MAX_TASKS];
+    size_t n_tasks;
+
+#if CONFIG_PYSIM_FRAME_POOL
+    frame_header_t *free_list;
+    uint32_t reserved_blocks;   // At the end of the pool, see ps_mem_reserve
+    uint32_t free_blocks, min_free_blocks;
+    bool pool_ready;
+#endif
+} mem = { .lock = portMUX_INITIALIZER_UNLOCKED };
+
+static const char *subsystem_names[PS_MEM_MAX] = { "link", "vnic", "spi", "pcap" };
+
+#if CONFIG_PYSIM_FRAME_POOL
+
+static uint8_t pool[POOL_BLOCKS * POOL_STRIDE] __attribute__((aligned(8)));
+
+// Must be called with the lock held
+static void pool_init(void) {
+    for (size_t i = POOL_BLOCKS - mem.reserved_blocks; i > 0; i--) {
+        frame_header_t *header = (frame_header_t *)(pool + (i - 1) * POOL_STRIDE);
+        header->next_free = mem.free_list;
+        mem.free_list = header;
+    }
+    mem.free_blocks = mem.min_free_blocks = POOL_BLOCKS - mem.reserved_blocks;
+    mem.pool_ready = true;
+}
+
+// Must be called with the lock held
+static frame_header_t *frame_take(size_t len) {
+    if (!mem.pool_ready) {
+        pool_init();
+    }
+
+    frame_header_t *header = mem.free_list;
+    if (len > CONFIG_PYSIM_FRAME_POOL_BLOCK_SIZE || !header) {
+        return NULL;
+    }
+
+    mem.free_list = header->next_free;
+    if (--mem.free_blocks < mem.min_free_blocks) {
+        mem.min_free_blocks = mem.free_blocks;
+    }
+    header->size = sizeof(frame_header_t) + len;
+    return header;
+}
+
+// Must be called with the lock held
+static void frame_give(frame_header_t *header) {
+    header->next_free = mem.free_list;
+    mem.free_list = header;
+    mem.free_blocks++;
+}
+
+#endif // CONFIG_PYSIM_FRAME_POOL
+
+void *ps_frame_alloc(ps_mem_subsystem_t subsystem, size_t len) {
+    if (subsystem >= PS_MEM_MAX) {
+        return NULL;
+    }
+
+#if CONFIG_PYSIM_FRAME_POOL
+    portENTER_CRITICAL(&mem.lock);
+    frame_header_t *header = frame_take(len);
+#else
+    frame_header_t *header = malloc(sizeof(frame_header_t) + len);
+    if (header) {
+        header->size = sizeof(frame_header_t) + len;
+    }
+    portENTER_CRITICAL(&mem.lock);
+#endif
+
+    ps_mem_stats_t *stats = &mem.subsystems[subsystem];
+    if (!header) {
+        stats->alloc_failures++;
+        portEXIT_CRITICAL(&mem.lock);
+        return NULL;
+    }
+
+    header->subsystem = subsystem;
+    stats->allocs++;
+    stats->heap_bytes += header->size;
+    if (stats->heap_bytes > stats->heap_high_water) {
+        stats->heap_high_water = stats->heap_bytes;
+    }
+    portEXIT_CRITICAL(&mem.lock);
+    return header + 1;
+}
+
+void ps_frame_free(void *frame) {
+    if (!frame) {
+        return;
+    }
+
+    frame_header_t *header = (frame_header_t *)frame - 1;
+    portENTER_CRITICAL(&mem.lock);
+    mem.subsystems[header->subsystem].heap_bytes -= header->size;
+#if CONFIG_PYSIM_FRAME_POOL
+    frame_give(header);
+    portEXIT_CRITICAL(&mem.lock);
+#else
+    portEXIT_CRITICAL(&mem.lock);
+    free(header);
+#endif
+}
+
+void ps_mem_add_static(ps_mem_subsystem_t subsystem, size_t bytes) {
+    if (subsystem >= PS_MEM_MAX) {
+        return;
+    }
+
+    portENTER_CRITICAL(&mem.lock);
+    mem.subsystems[subsystem].static_bytes += bytes;
+    portEXIT_CRITICAL(&mem.lock);
+}
+
+void *ps_mem_reserve(ps_mem_subsystem_t subsystem, size_t bytes) {
+    if (subsystem >= PS_MEM_MAX) {
+        return NULL;
+    }
+
+#if CONFIG_PYSIM_FRAME_POOL
+    size_t blocks = (bytes + POOL_STRIDE - 1) / POOL_STRIDE;
+    portENTER_CRITICAL(&mem.lock);
+    // The free list covers every block not reserved once the pool hands out frames
+    if (mem.pool_ready || blocks > POOL_BLOCKS - mem.reserved_blocks) {
+        portEXIT_CRITICAL(&mem.lock);
+        ESP_LOGE(TAG, "cannot reserve %zuB from the frame pool", bytes);
+        return NULL;
+    }
+    mem.reserved_blocks += blocks;
+    void *area = pool + (POOL_BLOCKS - mem.reserved_blocks) * POOL_STRIDE;
+    bytes = blocks * POOL_STRIDE;
+#else
+    void *area = malloc(bytes);
+    if (!area) {
+        return NULL;
+    }
+    portENTER_CRITICAL(&mem.lock);
+#endif
+
+    mem.subsystems[subsystem].static_bytes += bytes;
+    portEXIT_CRITICAL(&mem.lock);
+    return area;
+}
+
+void ps_mem_register_task(ps_mem_subsystem_t subsystem, TaskHandle_t task, uint32_t stack_size) {
+    if (subsystem >= PS_MEM_MAX || !task) {
+        return;
+    }
+
+    portENTER_CRITICAL(&mem.lock);
+    if (mem.n_tasks >= CONFIG_PYSIM_MEM_MAX_TASKS) {
+        portEXIT_CRITICAL(&mem.lock);
+        ESP_LOGW(TAG, "stack of task %p not tracked -- increase CONFIG_PYSIM_MEM_MAX_TASKS", task);
+        return;
+    }
+
+    mem.tasks[mem.n_tasks].handle = task;
+    mem.tasks[mem.n_tasks].stack_size = stack_size;
+    mem.tasks[mem.n_tasks].subsystem = subsystem;
+    mem.n_tasks++;
+    portEXIT_CRITICAL(&mem.lock);
+}
+
+esp_err_t ps_mem_get_stats(ps_mem_subsystem_t subsystem, ps_mem_stats_t *stats) {
+    if (subsystem >= PS_MEM_MAX || !stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&mem.lock);
+    *stats = mem.subsystems[subsystem];
+    size_t n_tasks = mem.n_tasks;
+    portEXIT_CRITICAL(&mem.lock);
+
+    // Tasks are only ever added, entries below n_tasks are stable
+    for (size_t i = 0; i < n_tasks; i++) {
+        if (mem.tasks[i].subsystem != subsystem) {
+            continue;
+        }
+
+        uint32_t unused = uxTaskGetStackHighWaterMark(mem.tasks[i].handle) * sizeof(StackType_t);
+        stats->tasks++;
+        stats->stack_bytes += mem.tasks[i].stack_size;
+        stats->stack_high_water += unused < mem.tasks[i].stack_size ? mem.tasks[i].stack_size - unused : 0;
+    }
+    return ESP_OK;
+}
+
+void ps_frame_pool_get_stats(ps_frame_pool_stats_t *stats) {
+    *stats = (ps_frame_pool_stats_t){ 0 };
+#if CONFIG_PYSIM_FRAME_POOL
+    portENTER_CRITICAL(&mem.lock);
+    stats->enabled = true;
+    stats->block_size = CONFIG_PYSIM_FRAME_POOL_BLOCK_SIZE;
+    stats->blocks = POOL_BLOCKS;
+    stats->reserved_blocks = mem.reserved_blocks;
+    // Building the free list here would make every later ps_mem_reserve fail
+    if (mem.pool_ready) {
+        stats->free_blocks = mem.free_blocks;
+        stats->min_free_blocks = mem.min_free_blocks;
+    } else {
+        stats->free_blocks = stats->min_free_blocks = POOL_BLOCKS - mem.reserved_blocks;
+    }
+    portEXIT_CRITICAL(&mem.lock);
+#endif
+}
+
+void ps_mem_log(void) {
+    for (ps_mem_subsystem_t i = 0; i < PS_MEM_MAX; i++) {
+        ps_mem_stats_t stats;
+        ps_mem_get_stats(i, &stats);
+        ESP_LOGI(
+            TAG,
+            "%s: static=%" PRIu32 "B heap=%" PRIu32 "B (max %" PRIu32 "B, %" PRIu32 " allocs, %" PRIu32 " failed) "
+            "stack=%" PRIu32 "/%" PRIu32 "B in %" PRIu32 " tasks",
+            subsystem_names[i], stats.static_bytes, stats.heap_bytes, stats.heap_high_water,
+            stats.allocs, stats.alloc_failures, stats.stack_high_water, stats.stack_bytes, stats.tasks
+        );
+    }
+
+    ps_frame_pool_stats_t pool_stats;
+    ps_frame_pool_get_stats(&pool_stats);
+    if (pool_stats.enabled) {
+        ESP_LOGI(
+            TAG,
+            "frame pool: %" PRIu32 "x%" PRIu32 "B, %" PRIu32 " reserved, %" PRIu32 " free (min %" PRIu32 ")",
+            pool_stats.blocks, pool_stats.block_size, pool_stats.reserved_blocks, pool_stats.free_blocks,
+            pool_stats.min_free_blocks
+        );
+    }
+}
@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "pysim.h"
+#include "pysim_stats.h"
+#include "protocol.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+
+#define TAG "pysim_stats"
+
+void ps_histogram_record(ps_histogram_t *histogram, uint32_t us) {
+    size_t bucket = (us == 0) ? 0 : (31 - __builtin_clz(us));
+    if (bucket >= PS_HISTOGRAM_BUCKETS) {
+        bucket = PS_HISTOGRAM_BUCKETS - 1;
+    }
+
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->sum_us += us;
+    if (us > histogram->max_us) {
+        histogram->max_us = us;
+    }
+}
+
+uint32_t ps_histogram_percentile(const ps_histogram_t *histogram, uint32_t percentile) {
+    if (histogram->count == 0) {
+        return 0;
+    }
+
+    uint64_t target = ((uint64_t)histogram->count * percentile + 99) / 100;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < PS_HISTOGRAM_BUCKETS - 1; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= target) {
+            uint32_t upper = 1u << (i + 1);
+            return upper < histogram->max_us ? upper : histogram->max_us;
+        }
+    }
+
+    return histogram->max_us;
+}
+
+#if CONFIG_PYSIM_STATS
+
+static struct {
+    portMUX_TYPE lock;
+
+    // slot + 1 for every command ID, 0 if the command has no slot yet
+    uint8_t command_slot[256];
+    uint8_t command_ids[CONFIG_PYSIM_STATS_MAX_COMMANDS];
+    size_t n_commands;
+    uint32_t dropped_commands;
+    ps_command_stats_t commands[CONFIG_PYSIM_STATS_MAX_COMMANDS];
+
+    uint32_t event_counts[256];
+
+    esp_timer_handle_t log_timer;
+} stats = { .lock = portMUX_INITIALIZER_UNLOCKED };
+
+_Static_assert(CONFIG_PYSIM_STATS_MAX_COMMANDS < 256, "CONFIG_PYSIM_STATS_MAX_COMMANDS must fit in a command slot");
+
+static uint32_t clamp_us(int64_t us) {
+    if (us < 0) {
+        return 0;
+    }
+    return us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+}
+
+static void log_timer_cb(void *arg) {
+    ps_stats_log();
+}
+
+void ps_stats_init(void) {
+    if (CONFIG_PYSIM_STATS_LOG_PERIOD_MS == 0 || stats.log_timer) {
+        return;
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = log_timer_cb,
+        .name = "ps_stats_log",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &stats.log_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(stats.log_timer, CONFIG_PYSIM_STATS_LOG_PERIOD_MS * 1000ULL));
+}
+
+void ps_stats_record_command(uint8_t command, uint8_t status, uint32_t bytes_out, uint32_t bytes_in, int64_t lock_wait_us, int64_t round_trip_us) {
+    portENTER_CRITICAL(&stats.lock);
+    uint8_t slot = stats.command_slot[command];
+    if (slot == 0) {
+        if (stats.n_commands >= CONFIG_PYSIM_STATS_MAX_COMMANDS) {
+            stats.dropped_commands++;
+            portEXIT_CRITICAL(&stats.lock);
+            return;
+        }
+        stats.command_ids[stats.n_commands] = command;
+        slot = ++stats.n_commands;
+        stats.command_slot[command] = slot;
+    }
+
+    ps_command_stats_t *cmd = &stats.commands[slot - 1];
+    cmd->calls++;
+    if (status & PS_STATUS_MASK_ERROR) {
+        cmd->errors++;
+    }
+    cmd->bytes_out += bytes_out;
+    cmd->bytes_in += bytes_in;
+    ps_histogram_record(&cmd->lock_wait, clamp_us(lock_wait_us));
+    ps_histogram_record(&cmd->round_trip, clamp_us(round_trip_us));
+    portEXIT_CRITICAL(&stats.lock);
+}
+
+void ps_stats_record_event(uint8_t event_id) {
+    portENTER_CRITICAL(&stats.lock);
+    stats.event_counts[event_id]++;
+    portEXIT_CRITICAL(&stats.lock);
+}
+
+esp_err_t ps_stats_get_command(uint8_t command, ps_command_stats_t *out) {
+    if (!out) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    portENTER_CRITICAL(&stats.lock);
+    uint8_t slot = stats.command_slot[command];
+    if (slot != 0) {
+        *out = stats.commands[slot - 1];
+        err = ESP_OK;
+    }
+    portEXIT_CRITICAL(&stats.lock);
+    return err;
+}
+
+uint32_t ps_stats_get_event_count(uint8_t event_id) {
+    portENTER_CRITICAL(&stats.lock);
+    uint32_t count = stats.event_counts[event_id];
+    portEXIT_CRITICAL(&stats.lock);
+    return count;
+}
+
+void ps_stats_reset(void) {
+    portENTER_CRITICAL(&stats.lock);
+    memset(stats.command_slot, 0, sizeof(stats.command_slot));
+    memset(stats.commands, 0, sizeof(stats.commands));
+    memset(stats.event_counts, 0, sizeof(stats.event_counts));
+    stats.n_commands = 0;
+    stats.dropped_commands = 0;
+    portEXIT_CRITICAL(&stats.lock);
+}
+
+void ps_stats_log(void) {
+    size_t n_commands;
+    portENTER_CRITICAL(&stats.lock);
+    n_commands = stats.n_commands;
+    portEXIT_CRITICAL(&stats.lock);
+
+    for (size_t i = 0; i < n_commands; i++) {
+        ps_command_stats_t cmd;
+        portENTER_CRITICAL(&stats.lock);
+        uint8_t id = stats.command_ids[i];
+        cmd = stats.commands[i];
+        portEXIT_CRITICAL(&stats.lock);
+
+        ESP_LOGI(
+            TAG,
+            "cmd=0x%02X calls=%" PRIu32 " err=%" PRIu32 " out=%" PRIu64 "B in=%" PRIu64 "B "
+            "rtt(avg/p50/p99/max)=%" PRIu32 "/%" PRIu32 "/%" PRIu32 "/%" PRIu32 "us "
+            "wait(avg/p99/max)=%" PRIu32 "/%" PRIu32 "/%" PRIu32 "us",
+            id, cmd.calls, cmd.errors, cmd.bytes_out, cmd.bytes_in,
+            cmd.round_trip.count ? (uint32_t)(cmd.round_trip.sum_us / cmd.round_trip.count) : 0,
+            ps_histogram_percentile(&cmd.round_trip, 50),
+            ps_histogram_percentile(&cmd.round_trip, 99),
+            cmd.round_trip.max_us,
+            cmd.lock_wait.count ? (uint32_t)(cmd.lock_wait.sum_us / cmd.lock_wait.count) : 0,
+            ps_histogram_percentile(&cmd.lock_wait, 99),
+            cmd.lock_wait.max_us
+        );
+    }
+
+    char events[128];
+    size_t len = 0;
+    for (size_t id = 0; id < 256 && len < sizeof(events); id++) {
+        uint32_t count = ps_stats_get_event_count(id);
+        if (count) {
+            len += snprintf(events + len, sizeof(events) - len, " 0x%02X=%" PRIu32, (unsigned)id, count);
+        }
+    }
+    if (len) {
+        ESP_LOGI(TAG, "events:%s", events);
+    }
+
+    if (stats.dropped_commands) {
+        ESP_LOGW(TAG, "%" PRIu32 " calls not tracked -- increase CONFIG_PYSIM_STATS_MAX_COMMANDS", stats.dropped_commands);
+    }
+}
+
+#else
+
+esp_err_t ps_stats_get_command(uint8_t command, ps_command_stats_t *out) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+uint32_t ps_stats_get_event_count(uint8_t event_id) {
+    return 0;
+}
+
+void ps_stats_reset(void) {
+}
+
+void ps_stats_log(void) {
+}
+
+#endif // CONFIG_PYSIM_STATS
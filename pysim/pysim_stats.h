@@ -0,0 +1,29 @@
+#ifndef _PYSIM_STATS_H_
+#define _PYSIM_STATS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pysim.h"
+
+#if CONFIG_PYSIM_STATS
+
+#include "esp_timer.h"
+
+#define PS_STATS_NOW() esp_timer_get_time()
+
+void ps_stats_init(void);
+void ps_stats_record_command(uint8_t command, uint8_t status, uint32_t bytes_out, uint32_t bytes_in, int64_t lock_wait_us, int64_t round_trip_us);
+void ps_stats_record_event(uint8_t event_id);
+
+#else
+
+#define PS_STATS_NOW() ((int64_t)0)
+
+static inline void ps_stats_init(void) { }
+static inline void ps_stats_record_command(uint8_t command, uint8_t status, uint32_t bytes_out, uint32_t bytes_in, int64_t lock_wait_us, int64_t round_trip_us) { }
+static inline void ps_stats_record_event(uint8_t event_id) { }
+
+#endif // CONFIG_PYSIM_STATS
+
+#endif // _PYSIM_STATS_H_
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "pysim_trace.h"
+#include "esp_log.h"
+
+#define TAG "pysim_trace"
+
+#if CONFIG_PYSIM_TRACE
+
+#include "esp_timer.h"
+
+#define RING_MASK (CONFIG_PYSIM_TRACE_ENTRIES - 1)
+
+_Static_assert((CONFIG_PYSIM_TRACE_ENTRIES & RING_MASK) == 0, "CONFIG_PYSIM_TRACE_ENTRIES must be a power of two");
+
+static struct {
+    uint32_t head;
+    ps_trace_record_t records[CONFIG_PYSIM_TRACE_ENTRIES];
+} ring = { 0 };
+
+void ps_trace_record(uint8_t layer, uint8_t iface, uint8_t dir, const void *data, size_t len) {
+    uint32_t index = __atomic_fetch_add(&ring.head, 1, __ATOMIC_RELAXED);
+    ps_trace_record_t *record = &ring.records[index & RING_MASK];
+
+    // Readers skip records whose sequence does not match the slot they expect
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    record->timestamp_us = (uint32_t)esp_timer_get_time();
+    record->layer = layer;
+    record->iface = iface;
+    record->dir = dir;
+    record->len = len > UINT16_MAX ? UINT16_MAX : len;
+    record->header_len = len < PS_TRACE_HEADER_LEN ? len : PS_TRACE_HEADER_LEN;
+    if (data && record->header_len) {
+        memcpy(record->header, data, record->header_len);
+    }
+
+    __atomic_store_n(&record->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+size_t ps_trace_snapshot(ps_trace_record_t *out, size_t max) {
+    uint32_t head = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+    uint32_t available = head < CONFIG_PYSIM_TRACE_ENTRIES ? head : CONFIG_PYSIM_TRACE_ENTRIES;
+    if (available > max) {
+        available = max;
+    }
+
+    size_t copied = 0;
+    for (uint32_t index = head - available; index != head; index++) {
+        const ps_trace_record_t *record = &ring.records[index & RING_MASK];
+        if (__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) != index + 1) {
+            continue;
+        }
+
+        out[copied] = *record;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        // Overwritten while copying
+        if (__atomic_load_n(&record->seq, __ATOMIC_RELAXED) != index + 1) {
+            continue;
+        }
+        copied++;
+    }
+
+    return copied;
+}
+
+void ps_trace_clear(void) {
+    for (size_t i = 0; i < CONFIG_PYSIM_TRACE_ENTRIES; i++) {
+        __atomic_store_n(&ring.records[i].seq, 0, __ATOMIC_RELAXED);
+    }
+}
+
+void ps_trace_dump(void) {
+    static const char *layers[] = { "link", "vnic", "lwip" };
+    static ps_trace_record_t records[CONFIG_PYSIM_TRACE_ENTRIES];
+
+    size_t n = ps_trace_snapshot(records, CONFIG_PYSIM_TRACE_ENTRIES);
+    ESP_LOGI(TAG, "%zu records", n);
+
+    for (size_t i = 0; i < n; i++) {
+        const ps_trace_record_t *record = &records[i];
+        char hex[PS_TRACE_HEADER_LEN * 2 + 1] = { 0 };
+        for (size_t j = 0; j < record->header_len; j++) {
+            snprintf(hex + j * 2, 3, "%02x", record->header[j]);
+        }
+
+        ESP_LOGI(
+            TAG, "%10" PRIu32 " %s %3u %s len=%4u %s",
+            record->timestamp_us,
+            record->layer < sizeof(layers) / sizeof(layers[0]) ? layers[record->layer] : "?",
+            record->iface,
+            record->dir == PS_TRACE_OUT ? "out" : "in ",
+            record->len,
+            hex
+        );
+    }
+}
+
+#else
+
+void ps_trace_record(uint8_t layer, uint8_t iface, uint8_t dir, const void *data, size_t len) {
+}
+
+size_t ps_trace_snapshot(ps_trace_record_t *out, size_t max) {
+    return 0;
+}
+
+void ps_trace_dump(void) {
+    ESP_LOGW(TAG, "tracing disabled -- set CONFIG_PYSIM_TRACE");
+}
+
+void ps_trace_clear(void) {
+}
+
+#endif // CONFIG_PYSIM_TRACE
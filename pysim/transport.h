@@ -0,0 +1,26 @@
+#ifndef _PYSIM_TRANSPORT_H_
+#define _PYSIM_TRANSPORT_H_
+
+#include <stddef.h>
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+// Byte stream connecting pysim with the simulator.
+typedef struct ps_transport {
+    const char *name;
+
+    esp_err_t (*open)(void);
+    // Blocks until `len` bytes were read. Returns the number of bytes read, less than `len` on error.
+    size_t (*read)(void *buffer, size_t len);
+    // Blocks until `len` bytes were written. Returns the number of bytes written, less than `len` on error.
+    size_t (*write)(const void *buffer, size_t len);
+} ps_transport_t;
+
+#if CONFIG_IDF_TARGET_LINUX
+extern const ps_transport_t ps_transport_host;
+#else
+extern const ps_transport_t ps_transport_uart;
+#endif
+
+#endif // _PYSIM_TRANSPORT_H_
@@ -0,0 +1,109 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "transport.h"
+#include "esp_log.h"
+
+#define TAG "pysim_host"
+
+static int link_fd = -1;
+
+static int open_socket(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        ESP_LOGE(TAG, "socket path too long: %s", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int open_pty(const char *path) {
+    int fd = open(path, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    return fd;
+}
+
+static esp_err_t host_open(void) {
+    const char *path = getenv("PYSIM_LINK");
+    if (!path) {
+        path = CONFIG_PYSIM_HOST_LINK_PATH;
+    }
+
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        ESP_LOGE(TAG, "cannot open link %s: %s", path, strerror(errno));
+        return ESP_FAIL;
+    }
+
+    link_fd = S_ISSOCK(st.st_mode) ? open_socket(path) : open_pty(path);
+    if (link_fd < 0) {
+        ESP_LOGE(TAG, "cannot open link %s: %s", path, strerror(errno));
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "connected to simulator at %s", path);
+    return ESP_OK;
+}
+
+static size_t host_read(void *buffer, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = read(link_fd, (uint8_t *)buffer + done, len - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+static size_t host_write(const void *buffer, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(link_fd, (const uint8_t *)buffer + done, len - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+const ps_transport_t ps_transport_host = {
+    .name = "host",
+    .open = host_open,
+    .read = host_read,
+    .write = host_write,
+};
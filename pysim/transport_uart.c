@@ -0,0 +1,36 @@
+#include "sdkconfig.h"
+#include "transport.h"
+#include "freertos/FreeRTOS.h"
+#include "driver/uart.h"
+
+#define PS_UART_PORT CONFIG_PYSIM_UART_PORT
+
+static esp_err_t uart_open(void) {
+    uart_config_t uart_config = {
+        .baud_rate = CONFIG_PYSIM_UART_BAUD_RATE,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+    };
+    ESP_ERROR_CHECK(uart_driver_install(PS_UART_PORT, CONFIG_PYSIM_UART_RX_BUFFER_SIZE, CONFIG_PYSIM_UART_TX_BUFFER_SIZE, 0, NULL, 0));
+    ESP_ERROR_CHECK(uart_param_config(PS_UART_PORT, &uart_config));
+    return ESP_OK;
+}
+
+static size_t uart_read(void *buffer, size_t len) {
+    int read = uart_read_bytes(PS_UART_PORT, buffer, len, portMAX_DELAY);
+    return read < 0 ? 0 : read;
+}
+
+static size_t uart_write(const void *buffer, size_t len) {
+    int written = uart_write_bytes(PS_UART_PORT, buffer, len);
+    return written < 0 ? 0 : written;
+}
+
+const ps_transport_t ps_transport_uart = {
+    .name = "uart",
+    .open = uart_open,
+    .read = uart_read,
+    .write = uart_write,
+};
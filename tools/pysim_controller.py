@@ -0,0 +1,925 @@
+#!/usr/bin/env python3
+"""Local stand-in for the QEMU PySIM adapter.
+
+Speaks the pysim link protocol over a Unix socket or a pty so the firmware
+side (usually built for the ESP-IDF Linux target) can be driven without the
+full simulator, at controlled and repeatable loads.
+
+Every message is a little endian uint32 header, `(command << 24) | length`,
+followed by `length` bytes of payload. Responses use the same framing with
+the status in the upper byte.
+"""
+
+import argparse
+import fcntl
+import json
+import os
+import random
+import socket
+import struct
+import sys
+import threading
+import time
+import tty
+from collections import deque
+
+PS_STATUS_MASK_ERROR = 0x80
+PS_CMD_LONG_POLL = 0xF4
+PS_CMD_RETRIEVE_EVENT = 0xF5
+PS_CMD_ECHO = 0xF6
+
+# i4a commands
+CMD_SPI_SEND = 0x01
+CMD_GET_CONFIG_BITS = 0x03
+CMD_SET_MODE = 0x05
+CMD_SET_AP_CONFIG = 0x06
+CMD_SET_STA_CONFIG = 0x07
+CMD_CONNECT = 0x08
+CMD_DISCONNECT = 0x09
+CMD_DEAUTH_STA = 0x0A
+CMD_START = 0x0B
+CMD_STOP = 0x0C
+CMD_SCAN_GET_AP_NUM = 0x0D
+CMD_SCAN_GET_AP_RECORD = 0x0F
+CMD_SCAN_START = 0x10
+CMD_STA_GET_AP_INFO = 0x11
+CMD_AP_GET_STA_NUM = 0x12
+CMD_AP_GET_STA_RECORD = 0x13
+CMD_STA_TX = 0x14
+CMD_AP_TX = 0x17
+CMD_SET_LINK_OPTIONS = 0x18
+CMD_PCAP_DATA = 0x19
+CMD_AP_TX_BATCH = 0x1A
+CMD_STA_TX_BATCH = 0x1B
+CMD_WIFI_BATCH = 0x1C
+
+LINK_OPT_FRAME_TIMESTAMPS = 1 << 0
+LINK_OPT_TX_BATCH = 1 << 1
+LINK_OPT_CHECKSUM_OFFLOAD = 1 << 2
+LINK_OPT_HEADER_COMPRESSION = 1 << 3
+LINK_OPT_WIFI_BATCH = 1 << 4
+LINK_OPT_FRAME_FLAGS = 1 << 5
+LINK_OPTS_SUPPORTED = (LINK_OPT_FRAME_TIMESTAMPS | LINK_OPT_TX_BATCH | LINK_OPT_CHECKSUM_OFFLOAD |
+                       LINK_OPT_HEADER_COMPRESSION | LINK_OPT_WIFI_BATCH | LINK_OPT_FRAME_FLAGS)
+
+# First byte of the framed frame events (LINK_OPT_FRAME_FLAGS)
+FRAME_FLAG_TIMESTAMP = 1 << 0
+FRAME_FLAG_COMPRESSED = 1 << 1
+FRAME_FLAG_COMPRESS_RESET = 1 << 2
+
+# Commands CMD_WIFI_BATCH may carry, see ps_wifi_txn_commit
+WIFI_BATCH_COMMANDS = (CMD_SET_MODE, CMD_SET_AP_CONFIG, CMD_SET_STA_CONFIG, CMD_CONNECT, CMD_DISCONNECT,
+                       CMD_START, CMD_STOP)
+
+# i4a events
+EVT_SPI_RX = 0x01
+EVT_STA_ARRIVED = 0x02
+EVT_STA_LEFT = 0x03
+EVT_CONNECTED_TO_AP = 0x04
+EVT_CONNECTION_TO_AP_LOST = 0x05
+EVT_WLAN_AP_RX = 0x06
+EVT_WLAN_STA_RX = 0x07
+EVT_WLAN_AP_RX_FRAMED = 0x08
+EVT_WLAN_STA_RX_FRAMED = 0x09
+
+FRAME_EVENTS = (EVT_WLAN_AP_RX, EVT_WLAN_STA_RX)
+FRAMED_EVENTS = {EVT_WLAN_AP_RX: EVT_WLAN_AP_RX_FRAMED, EVT_WLAN_STA_RX: EVT_WLAN_STA_RX_FRAMED}
+
+# Capture log written by ps_capture_start, see pysim/pysim_capture.h
+CAPTURE_MAGIC = b"PSCP"
+CAPTURE_VERSION = 1
+CAPTURE_FILE_HEADER = struct.Struct("<4sHH")
+CAPTURE_RECORD = struct.Struct("<IBI")
+CAPTURE_COMMAND, CAPTURE_RESPONSE, CAPTURE_EVENT = range(3)
+
+ERR_UNKNOWN_COMMAND = 0xFF
+ERR_FRAME_DECODE = 0x81
+
+# Header compression formats and limits, see i4a_pysim/frame_compress.h
+HC_RAW, HC_FULL, HC_DELTA = range(3)
+HC_CONTEXTS = 16
+HC_MAX_HEADER = 96
+HC_GENERIC_HEADER = 64
+HC_REFRESH = 32
+
+# Path indexes of CMD_PCAP_DATA records, see ps_pcap_path_t
+PCAP_PATHS = ("ap_tx", "ap_rx", "sta_tx", "sta_rx")
+PCAP_RECORD = struct.Struct("<BIIII")
+LINKTYPE_ETHERNET = 1
+
+# Locally administered, experimental ethertype: lwIP drops these right after ethernet_input
+SYNTHETIC_ETHERTYPE = 0x88B5
+
+
+TUNSETIFF = 0x400454CA
+IFF_TAP = 0x0002
+IFF_NO_PI = 0x1000
+
+
+def now_us():
+    return time.monotonic_ns() // 1000
+
+
+def inet_checksum(data):
+    if len(data) % 2:
+        data += b"\x00"
+    total = sum(struct.unpack("!%dH" % (len(data) // 2), data))
+    while total >> 16:
+        total = (total & 0xFFFF) + (total >> 16)
+    return ~total & 0xFFFF
+
+
+def fill_checksums(frame):
+    """Fills in the IPv4, ICMP, UDP and TCP checksums of an Ethernet frame.
+
+    Stands for the simulator side of LINK_OPT_CHECKSUM_OFFLOAD, where the
+    firmware leaves them to be computed here.
+    """
+    if len(frame) < 34 or frame[12:14] != b"\x08\x00":
+        return frame
+
+    frame = bytearray(frame)
+    ihl = (frame[14] & 0x0F) * 4
+    total_len, = struct.unpack_from("!H", frame, 16)
+    fragment, = struct.unpack_from("!H", frame, 20)
+    if ihl < 20 or total_len < ihl or 14 + total_len > len(frame):
+        return bytes(frame)
+
+    struct.pack_into("!H", frame, 24, 0)
+    struct.pack_into("!H", frame, 24, inet_checksum(bytes(frame[14:14 + ihl])))
+
+    # Only the first fragment carries the transport header, and its checksum covers every fragment
+    if fragment & 0x3FFF:
+        return bytes(frame)
+
+    proto = frame[23]
+    start, end = 14 + ihl, 14 + total_len
+    offset = {1: 2, 6: 16, 17: 6}.get(proto)
+    if offset is None or end - start < offset + 2:
+        return bytes(frame)
+
+    struct.pack_into("!H", frame, start + offset, 0)
+    segment = bytes(frame[start:end])
+    if proto == 1:
+        checksum = inet_checksum(segment)
+    else:
+        pseudo = bytes(frame[26:34]) + struct.pack("!BBH", 0, proto, len(segment))
+        checksum = inet_checksum(pseudo + segment)
+        if proto == 17 and checksum == 0:
+            checksum = 0xFFFF
+    struct.pack_into("!H", frame, start + offset, checksum)
+    return bytes(frame)
+
+
+def flow_header(frame):
+    """Returns the header length and flow key of an IPv4 TCP or UDP frame, (0, None) for any other."""
+    if len(frame) < 34 or frame[12:14] != b"\x08\x00" or frame[14] >> 4 != 4:
+        return 0, None
+
+    ihl = (frame[14] & 0x0F) * 4
+    proto = frame[23]
+    fragment_offset, = struct.unpack_from("!H", frame, 20)
+    if ihl < 20 or fragment_offset & 0x1FFF or proto not in (6, 17):
+        return 0, None
+
+    l4 = 14 + ihl
+    l4_len = 8
+    if proto == 6:
+        if len(frame) < l4 + 20:
+            return 0, None
+        l4_len = (frame[l4 + 12] >> 4) * 4
+
+    header_len = l4 + l4_len
+    if l4_len < 8 or header_len > len(frame) or header_len > HC_MAX_HEADER:
+        return 0, None
+    return header_len, bytes(frame[:12] + frame[26:34] + bytes([proto]) + frame[l4:l4 + 4])
+
+
+class HeaderContext:
+    __slots__ = ("valid", "gen", "header", "key", "deltas")
+
+    def __init__(self):
+        self.valid = False
+        self.gen = 0
+        self.header = b""
+        self.key = None
+        self.deltas = 0
+
+
+class HeaderCodec:
+    """One direction of one interface of LINK_OPT_HEADER_COMPRESSION.
+
+    Mirrors i4a_pysim/frame_compress.c: headers are sent whole once per flow,
+    then as a bitmap of the bytes that changed followed by those bytes.
+    """
+
+    def __init__(self):
+        self.stats = {"frames": 0, "full": 0, "delta": 0, "raw": 0, "errors": 0, "frame_bytes": 0, "link_bytes": 0}
+        self.reset()
+
+    def reset(self):
+        self.contexts = [HeaderContext() for _ in range(HC_CONTEXTS)]
+        self.next_slot = 1
+        self.fresh = True  # Until the first frame encoded, which tells the decoder to reset
+
+    def account(self, kind, frame_len, link_len):
+        self.stats["frames"] += 1
+        self.stats[kind] += 1
+        self.stats["frame_bytes"] += frame_len
+        self.stats["link_bytes"] += link_len
+
+    def flow_slot(self, key):
+        for slot in range(1, HC_CONTEXTS):
+            if self.contexts[slot].valid and self.contexts[slot].key == key:
+                return slot
+        slot = self.next_slot
+        self.next_slot = slot % (HC_CONTEXTS - 1) + 1
+        self.contexts[slot].valid = False
+        self.contexts[slot].key = key
+        return slot
+
+    def encode(self, frame):
+        self.fresh = False
+        header_len, key = flow_header(frame)
+        slot = 0
+        if header_len:
+            slot = self.flow_slot(key)
+        else:
+            header_len = min(len(frame), HC_GENERIC_HEADER)
+
+        if header_len < 14:
+            self.account("raw", len(frame), len(frame) + 1)
+            return bytes([HC_RAW]) + frame
+
+        context = self.contexts[slot]
+        changed = []
+        delta = context.valid and len(context.header) == header_len and context.deltas < HC_REFRESH
+        if delta:
+            changed = [i for i in range(header_len) if frame[i] != context.header[i]]
+            delta = (header_len + 7) // 8 + len(changed) < header_len
+
+        context.gen = (context.gen + 1) & 0xFF
+        if delta:
+            bitmap = bytearray((header_len + 7) // 8)
+            for i in changed:
+                bitmap[i // 8] |= 1 << (i % 8)
+            out = bytes([HC_DELTA, slot, context.gen]) + bitmap + bytes(frame[i] for i in changed) + frame[header_len:]
+            context.deltas += 1
+            self.account("delta", len(frame), len(out))
+        else:
+            out = bytes([HC_FULL, slot, context.gen, header_len]) + frame
+            context.valid = True
+            context.deltas = 0
+            self.account("full", len(frame), len(out))
+        context.header = bytes(frame[:header_len])
+        return out
+
+    def decode(self, data):
+        """Returns the frame encoded in `data`, or None if it must be dropped."""
+        if not data:
+            self.stats["errors"] += 1
+            return None
+
+        if data[0] == HC_RAW:
+            self.account("raw", len(data) - 1, len(data))
+            return bytes(data[1:])
+
+        if len(data) < 3 or data[1] >= HC_CONTEXTS:
+            self.stats["errors"] += 1
+            return None
+        context = self.contexts[data[1]]
+
+        if data[0] == HC_FULL:
+            if len(data) < 4 or not 14 <= data[3] <= min(HC_MAX_HEADER, len(data) - 4):
+                self.stats["errors"] += 1
+                return None
+            frame = bytes(data[4:])
+            context.valid, context.gen, context.header = True, data[2], frame[:data[3]]
+            self.account("full", len(frame), len(data))
+            return frame
+
+        if data[0] != HC_DELTA or not context.valid or data[2] != (context.gen + 1) & 0xFF:
+            context.valid = False
+            self.stats["errors"] += 1
+            return None
+
+        header = bytearray(context.header)
+        bitmap_len = (len(header) + 7) // 8
+        offset = 3 + bitmap_len
+        if offset > len(data):
+            context.valid = False
+            self.stats["errors"] += 1
+            return None
+        for i in range(len(header)):
+            if data[3 + i // 8] & (1 << (i % 8)):
+                if offset >= len(data):
+                    context.valid = False
+                    self.stats["errors"] += 1
+                    return None
+                header[i] = data[offset]
+                offset += 1
+
+        context.gen, context.header = data[2], bytes(header)
+        frame = bytes(header) + bytes(data[offset:])
+        self.account("delta", len(frame), len(data))
+        return frame
+
+
+def read_capture(path):
+    """Yields (timestamp_us, kind, code, payload) for every record of a capture log."""
+    with open(path, "rb") as f:
+        magic, version, _ = CAPTURE_FILE_HEADER.unpack(f.read(CAPTURE_FILE_HEADER.size))
+        if magic != CAPTURE_MAGIC or version != CAPTURE_VERSION:
+            raise ValueError(f"{path}: not a version {CAPTURE_VERSION} pysim capture")
+
+        timestamp = 0
+        while True:
+            record = f.read(CAPTURE_RECORD.size)
+            if len(record) < CAPTURE_RECORD.size:
+                return
+            delta_us, kind, header = CAPTURE_RECORD.unpack(record)
+            payload = f.read(header & 0xFFFFFF)
+            if len(payload) < header & 0xFFFFFF:
+                return  # Truncated by a killed capture
+            timestamp += delta_us
+            yield timestamp, kind, header >> 24, payload
+
+
+class Replay:
+    """Recorded responses and events of a capture log, served back to the firmware.
+
+    Long polls are answered live, so only the simulator side of the session is
+    replayed: every other command gets the response recorded for its n-th call,
+    and events are queued at their recorded offsets (or back to back at max speed).
+    """
+
+    def __init__(self, path):
+        self.responses = {}
+        self.events = []
+
+        long_poll = False
+        pending = deque()
+        for timestamp, kind, code, payload in read_capture(path):
+            if kind == CAPTURE_COMMAND:
+                if code == PS_CMD_LONG_POLL:
+                    long_poll = True
+                else:
+                    pending.append((code, timestamp))
+            elif long_poll and kind == CAPTURE_RESPONSE:
+                # The simulator always releases a pending long poll before answering anything else
+                long_poll = False
+            elif pending:
+                command, sent_at = pending.popleft()
+                if kind == CAPTURE_EVENT:
+                    self.events.append((timestamp, code, payload))
+                else:
+                    self.responses.setdefault(command, deque()).append((code, payload, timestamp - sent_at))
+
+        self.stats = {"responses": 0, "responses_missing": 0, "events": 0, "events_total": len(self.events)}
+
+    def response(self, command):
+        queue = self.responses.get(command)
+        if not queue:
+            self.stats["responses_missing"] += 1
+            return None
+        self.stats["responses"] += 1
+        return queue.popleft()
+
+
+class Tap:
+    """Linux TAP device standing in for the peer on one side of the simulated WLAN."""
+
+    def __init__(self, name):
+        self.fd = os.open("/dev/net/tun", os.O_RDWR)
+        fcntl.ioctl(self.fd, TUNSETIFF, struct.pack("16sH", name.encode(), IFF_TAP | IFF_NO_PI))
+
+    def read(self):
+        return os.read(self.fd, 2048)
+
+    def write(self, frame):
+        os.write(self.fd, frame)
+
+
+class Sink:
+    """TCP and UDP discard servers, the far end of the benchmarks/ goodput tests."""
+
+    def __init__(self, port):
+        self.port = port
+        self.lock = threading.Lock()
+        self.stats = {"tcp_bytes": 0, "tcp_connections": 0, "udp_bytes": 0, "udp_datagrams": 0}
+
+    def start(self):
+        threading.Thread(target=self.serve_tcp, daemon=True).start()
+        threading.Thread(target=self.serve_udp, daemon=True).start()
+
+    def serve_tcp(self):
+        server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        server.bind(("0.0.0.0", self.port))
+        server.listen()
+        while True:
+            conn, _ = server.accept()
+            with self.lock:
+                self.stats["tcp_connections"] += 1
+            threading.Thread(target=self.drain, args=(conn,), daemon=True).start()
+
+    def drain(self, conn):
+        with conn:
+            while True:
+                data = conn.recv(65536)
+                if not data:
+                    return
+                with self.lock:
+                    self.stats["tcp_bytes"] += len(data)
+
+    def serve_udp(self):
+        server = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        server.bind(("0.0.0.0", self.port))
+        while True:
+            data = server.recv(65536)
+            with self.lock:
+                self.stats["udp_bytes"] += len(data)
+                self.stats["udp_datagrams"] += 1
+
+
+class Link:
+    """Byte stream to the firmware."""
+
+    def __init__(self, path):
+        self.path = path
+        self.fd = None
+        self.sock = None
+
+    def open(self):
+        if self.path == "pty":
+            master, slave = os.openpty()
+            tty.setraw(master)
+            tty.setraw(slave)
+            self.fd = master
+            print(f"pty ready: PYSIM_LINK={os.ttyname(slave)}", file=sys.stderr)
+            return
+
+        if os.path.exists(self.path):
+            os.unlink(self.path)
+        server = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        server.bind(self.path)
+        server.listen(1)
+        print(f"waiting for firmware: PYSIM_LINK={self.path}", file=sys.stderr)
+        self.sock, _ = server.accept()
+        server.close()
+
+    def read_exact(self, n):
+        chunks = []
+        while n > 0:
+            chunk = self.sock.recv(n) if self.sock else os.read(self.fd, n)
+            if not chunk:
+                raise EOFError("firmware closed the link")
+            chunks.append(chunk)
+            n -= len(chunk)
+        return b"".join(chunks)
+
+    def write_all(self, data):
+        if self.sock:
+            self.sock.sendall(data)
+            return
+        view = memoryview(data)
+        while view:
+            view = view[os.write(self.fd, view):]
+
+
+class PcapWriter:
+    """Splits CMD_PCAP_DATA chunks into one pcap file per vnic path."""
+
+    def __init__(self, prefix):
+        self.prefix = prefix
+        self.files = {}
+        self.frames = 0
+
+    def write_chunk(self, payload):
+        snaplen, = struct.unpack_from("<H", payload)
+        offset = 2
+        while offset + PCAP_RECORD.size <= len(payload):
+            path, ts_sec, ts_usec, caplen, length = PCAP_RECORD.unpack_from(payload, offset)
+            offset += PCAP_RECORD.size
+            name = PCAP_PATHS[path] if path < len(PCAP_PATHS) else f"path{path}"
+            if self.prefix:
+                f = self.files.get(name)
+                if f is None:
+                    f = self.files[name] = open(f"{self.prefix}-{name}.pcap", "wb")
+                    f.write(struct.pack("<IHHiIII", 0xA1B2C3D4, 2, 4, 0, 0, snaplen, LINKTYPE_ETHERNET))
+                f.write(struct.pack("<IIII", ts_sec, ts_usec, caplen, length) + payload[offset:offset + caplen])
+                f.flush()
+            offset += caplen
+            self.frames += 1
+
+
+class Controller:
+    def __init__(self, link, args):
+        self.link = link
+        self.args = args
+        self.rng = random.Random(args.seed)
+
+        self.lock = threading.Lock()
+        self.write_lock = threading.Lock()
+        self.events = deque()
+        self.long_poll_pending = False
+        self.frame_timestamps = False
+        self.frame_flags = False
+        self.checksum_offload = False
+        self.compression = False
+        self.tx_codecs = {CMD_AP_TX: HeaderCodec(), CMD_STA_TX: HeaderCodec()}
+        self.rx_codecs = {event_id: HeaderCodec() for event_id in FRAME_EVENTS}
+        self.tap = Tap(args.tap) if args.tap else None
+        self.tap_command = CMD_AP_TX if args.tap_side == "ap" else CMD_STA_TX
+        self.tap_event = EVT_WLAN_AP_RX if args.tap_side == "ap" else EVT_WLAN_STA_RX
+        self.sink = None
+        self.pcap = PcapWriter(args.pcap_prefix)
+        self.replay = Replay(args.replay) if args.replay else None
+        self.first_command = threading.Event()
+
+        self.mode = 0
+        self.started = False
+        self.ap_config = None
+        self.sta_config = None
+        self.scan_index = 0
+
+        self.stats = {
+            "commands": {},
+            "events": {},
+            "events_dropped": 0,
+            "batched_frames": 0,
+            "batched_wifi_ops": 0,
+            "started_at_us": now_us(),
+        }
+
+        self.handlers = {
+            CMD_SPI_SEND: self.cmd_spi_send,
+            CMD_GET_CONFIG_BITS: lambda payload: (self.args.config_bits, b""),
+            CMD_SET_MODE: self.cmd_set_mode,
+            CMD_SET_AP_CONFIG: self.cmd_set_ap_config,
+            CMD_SET_STA_CONFIG: self.cmd_set_sta_config,
+            CMD_CONNECT: self.cmd_connect,
+            CMD_DISCONNECT: self.cmd_disconnect,
+            CMD_DEAUTH_STA: lambda payload: (0, b""),
+            CMD_START: self.cmd_start,
+            CMD_STOP: self.cmd_stop,
+            CMD_SCAN_GET_AP_NUM: lambda payload: (self.args.scan_aps, b""),
+            CMD_SCAN_GET_AP_RECORD: self.cmd_scan_get_ap_record,
+            CMD_SCAN_START: self.cmd_scan_start,
+            CMD_STA_GET_AP_INFO: self.cmd_sta_get_ap_info,
+            CMD_AP_GET_STA_NUM: lambda payload: (self.args.stations, b""),
+            CMD_AP_GET_STA_RECORD: self.cmd_ap_get_sta_record,
+            CMD_STA_TX: lambda payload: self.cmd_frame_tx(CMD_STA_TX, payload),
+            CMD_AP_TX: lambda payload: self.cmd_frame_tx(CMD_AP_TX, payload),
+            CMD_SET_LINK_OPTIONS: self.cmd_set_link_options,
+            CMD_PCAP_DATA: self.cmd_pcap_data,
+            CMD_AP_TX_BATCH: lambda payload: self.cmd_frame_tx_batch(CMD_AP_TX, payload),
+            CMD_STA_TX_BATCH: lambda payload: self.cmd_frame_tx_batch(CMD_STA_TX, payload),
+            CMD_WIFI_BATCH: self.cmd_wifi_batch,
+            PS_CMD_ECHO: lambda payload: (0, payload),
+        }
+
+    # -- link --
+
+    def respond(self, status, payload=b""):
+        with self.write_lock:
+            self.link.write_all(struct.pack("<I", (status << 24) | len(payload)) + payload)
+
+    def release_long_poll(self, status):
+        """Must be called with self.lock held."""
+        if self.long_poll_pending:
+            self.long_poll_pending = False
+            self.respond(status)
+
+    def post_event(self, event_id, payload=b"", block=False, encode=None):
+        """Queues an event. `encode` turns the event ID and payload into the ones sent, called
+        with self.lock held and only if the event is queued, so it sees events in order."""
+        while True:
+            with self.lock:
+                if len(self.events) < self.args.max_pending_events:
+                    self.events.append(encode(event_id, payload) if encode else (event_id, payload))
+                    self.release_long_poll(1)
+                    return True
+                if not block:
+                    self.stats["events_dropped"] += 1
+                    return False
+            time.sleep(0.0005)
+
+    def account(self, command, bytes_out, bytes_in):
+        entry = self.stats["commands"].setdefault(f"0x{command:02X}", {"calls": 0, "bytes_in": 0, "bytes_out": 0})
+        entry["calls"] += 1
+        entry["bytes_in"] += bytes_in
+        entry["bytes_out"] += bytes_out
+
+    def serve(self):
+        while True:
+            header, = struct.unpack("<I", self.link.read_exact(4))
+            command, length = header >> 24, header & 0xFFFFFF
+            payload = self.link.read_exact(length) if length else b""
+            self.first_command.set()
+
+            if command == PS_CMD_LONG_POLL:
+                with self.lock:
+                    if self.events:
+                        self.respond(1)
+                    else:
+                        self.long_poll_pending = True
+                continue
+
+            if command == PS_CMD_RETRIEVE_EVENT:
+                with self.lock:
+                    event_id, data = self.events.popleft() if self.events else (0, b"")
+                key = f"0x{event_id:02X}"
+                self.stats["events"][key] = self.stats["events"].get(key, 0) + 1
+                self.respond(event_id, data)
+                continue
+
+            # Any other command wakes up the polling task first
+            with self.lock:
+                self.release_long_poll(0)
+
+            if self.args.response_delay_ms:
+                time.sleep(self.response_delay())
+
+            recorded = self.replay.response(command) if self.replay else None
+            if recorded:
+                status, response, service_us = recorded
+                if self.args.replay_speed == "original":
+                    time.sleep(service_us / 1e6)
+            else:
+                handler = self.handlers.get(command)
+                status, response = handler(payload) if handler else (ERR_UNKNOWN_COMMAND, b"")
+            self.account(command, len(response), len(payload))
+            self.respond(status, response)
+
+    def response_delay(self):
+        jitter = self.rng.uniform(-self.args.response_jitter_ms, self.args.response_jitter_ms)
+        return max(0.0, self.args.response_delay_ms + jitter) / 1000
+
+    # -- commands --
+
+    def cmd_spi_send(self, payload):
+        if self.args.spi_echo:
+            self.post_event(EVT_SPI_RX, payload)
+        return 0, b""
+
+    def cmd_set_mode(self, payload):
+        self.mode, = struct.unpack("<I", payload)
+        return 0, b""
+
+    def cmd_set_ap_config(self, payload):
+        ssid, password, channel = struct.unpack("<32s64sI", payload)
+        self.ap_config = (ssid.rstrip(b"\0"), password.rstrip(b"\0"), channel)
+        return 0, b""
+
+    def cmd_set_sta_config(self, payload):
+        ssid, password = struct.unpack("<32s64s", payload)
+        self.sta_config = (ssid.rstrip(b"\0"), password.rstrip(b"\0"))
+        return 0, b""
+
+    def cmd_connect(self, payload):
+        self.post_event(EVT_CONNECTED_TO_AP)
+        return 0, b""
+
+    def cmd_disconnect(self, payload):
+        self.post_event(EVT_CONNECTION_TO_AP_LOST)
+        return 0, b""
+
+    def cmd_start(self, payload):
+        self.started = True
+        return 0, b""
+
+    def cmd_stop(self, payload):
+        self.started = False
+        return 0, b""
+
+    def cmd_scan_start(self, payload):
+        self.scan_index = 0
+        return 0, b""
+
+    def ap_record(self, index):
+        bssid = bytes([0x02, 0x00, 0x00, 0x00, 0x00, index & 0xFF])
+        ssid = f"sim-ap-{index}".encode()
+        return struct.pack("<6s33sBb", bssid, ssid, 1 + index % 11, -40 - index)
+
+    def cmd_scan_get_ap_record(self, payload):
+        record = self.ap_record(self.scan_index)
+        self.scan_index += 1
+        return 0, record
+
+    def cmd_sta_get_ap_info(self, payload):
+        return 0, self.ap_record(0)
+
+    def cmd_ap_get_sta_record(self, payload):
+        index, = struct.unpack("<I", payload)
+        return 0, struct.pack("<6sb", bytes([0x02, 0x00, 0x00, 0x00, 0x01, index & 0xFF]), -50)
+
+    def cmd_frame_tx(self, command, payload):
+        if self.compression:
+            payload = self.tx_codecs[command].decode(payload)
+            if payload is None:
+                # The node resets its encoder on any error, resynchronizing the flows
+                return ERR_FRAME_DECODE, b""
+        if self.tap and command == self.tap_command:
+            self.tap.write(fill_checksums(payload) if self.checksum_offload else payload)
+        return 0, b""
+
+    def cmd_set_link_options(self, payload):
+        options, = struct.unpack("<I", payload)
+        self.frame_timestamps = bool(options & LINK_OPT_FRAME_TIMESTAMPS)
+        self.frame_flags = bool(options & LINK_OPT_FRAME_FLAGS)
+        self.checksum_offload = bool(options & LINK_OPT_CHECKSUM_OFFLOAD)
+        with self.lock:
+            compression = bool(options & LINK_OPT_HEADER_COMPRESSION)
+            if compression and not self.compression:
+                for codec in list(self.tx_codecs.values()) + list(self.rx_codecs.values()):
+                    codec.reset()
+            self.compression = compression
+        return 0, struct.pack("<QI", now_us(), options & LINK_OPTS_SUPPORTED)
+
+    def cmd_frame_tx_batch(self, command, payload):
+        status = 0
+        offset = 0
+        while offset + 2 <= len(payload):
+            length, = struct.unpack_from("<H", payload, offset)
+            status = self.cmd_frame_tx(command, payload[offset + 2:offset + 2 + length])[0] or status
+            self.stats["batched_frames"] += 1
+            offset += 2 + length
+        return status, b""
+
+    def cmd_wifi_batch(self, payload):
+        """Runs `(command, uint16 length, arguments)` ops in order up to the first that fails.
+
+        Answers with the status of the first failure and one status byte per op run.
+        """
+        statuses = bytearray()
+        offset = 0
+        while offset + 3 <= len(payload):
+            command, length = struct.unpack_from("<BH", payload, offset)
+            args = payload[offset + 3:offset + 3 + length]
+            offset += 3 + length
+
+            status = self.handlers[command](args)[0] if command in WIFI_BATCH_COMMANDS else ERR_UNKNOWN_COMMAND
+            statuses.append(status)
+            self.stats["batched_wifi_ops"] += 1
+            if status:
+                return status, bytes(statuses)
+        return 0, bytes(statuses)
+
+    def cmd_pcap_data(self, payload):
+        self.pcap.write_chunk(payload)
+        return 0, b""
+
+    # -- load generation --
+
+    def synthetic_frame(self):
+        size = self.rng.randint(self.args.frame_min, self.args.frame_max)
+        header = b"\xff" * 6 + bytes([0x02, 0x00, 0x00, 0x00, 0x00, 0x01]) + struct.pack(">H", SYNTHETIC_ETHERTYPE)
+        body = bytes(self.rng.getrandbits(8) for _ in range(max(0, size - len(header))))
+        return (header + body)[:size]
+
+    def inject_frames(self):
+        interval = 1.0 / self.args.event_rate
+        next_at = time.monotonic()
+        sent = 0
+        while self.args.event_count == 0 or sent < self.args.event_count:
+            next_at += interval
+            delay = next_at - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+
+            self.post_frame(self.rng.choice(self.args.frame_events), self.synthetic_frame())
+            sent += 1
+
+    def forward_tap(self):
+        while True:
+            self.post_frame(self.tap_event, self.tap.read())
+
+    def post_frame(self, event_id, frame):
+        """Framed events describe their own framing, so changing the link options never
+        affects the frames already queued. Legacy events carry the bare frame."""
+        def encode(event_id, frame):
+            if not self.frame_flags or event_id not in FRAMED_EVENTS:
+                return event_id, frame
+
+            flags = 0
+            codec = self.rx_codecs[event_id]
+            if self.compression:
+                flags |= FRAME_FLAG_COMPRESSED | (FRAME_FLAG_COMPRESS_RESET if codec.fresh else 0)
+                frame = codec.encode(frame)
+            if self.frame_timestamps:
+                flags |= FRAME_FLAG_TIMESTAMP
+                frame = struct.pack("<Q", now_us()) + frame
+            return FRAMED_EVENTS[event_id], bytes([flags]) + frame
+        return self.post_event(event_id, frame, encode=encode)
+
+    def replay_events(self):
+        self.first_command.wait()
+        if not self.replay.events:
+            return
+
+        origin = self.replay.events[0][0]
+        started = now_us()
+        for timestamp, event_id, payload in self.replay.events:
+            if self.args.replay_speed == "original":
+                delay = (timestamp - origin) - (now_us() - started)
+                if delay > 0:
+                    time.sleep(delay / 1e6)
+            self.post_event(event_id, payload, block=True)
+            self.replay.stats["events"] += 1
+
+        self.replay.stats["duration_s"] = round((now_us() - started) / 1e6, 3)
+
+    def inject_spi(self):
+        interval = 1.0 / self.args.spi_rate
+        while True:
+            time.sleep(interval)
+            self.post_event(EVT_SPI_RX, bytes(self.rng.getrandbits(8) for _ in range(self.args.spi_size)))
+
+    def report(self):
+        elapsed = (now_us() - self.stats["started_at_us"]) / 1e6
+        report = dict(self.stats, elapsed_s=round(elapsed, 3))
+        if self.pcap.frames:
+            report["pcap_frames"] = self.pcap.frames
+        if self.replay:
+            report["replay"] = dict(self.replay.stats)
+        if self.compression:
+            with self.lock:
+                report["compression"] = {
+                    "tx": {f"0x{command:02X}": dict(codec.stats) for command, codec in self.tx_codecs.items()},
+                    "rx": {f"0x{event_id:02X}": dict(codec.stats) for event_id, codec in self.rx_codecs.items()},
+                }
+        if self.sink:
+            with self.sink.lock:
+                report["sink"] = dict(self.sink.stats)
+        print(json.dumps(report), flush=True)
+
+
+def parse_args(argv):
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--link", default="/tmp/pysim.sock", help="Unix socket path to listen on, or 'pty'")
+    parser.add_argument("--seed", type=int, default=0, help="seed for every random choice, for repeatable runs")
+    parser.add_argument("--event-rate", type=float, default=0, help="WLAN frame events per second, 0 disables them")
+    parser.add_argument("--event-count", type=int, default=0, help="stop after this many frame events, 0 never stops")
+    parser.add_argument("--frame-events", type=lambda s: [int(x, 0) for x in s.split(",")],
+                        default=list(FRAME_EVENTS), help="event IDs used for frames (default: 0x06,0x07)")
+    parser.add_argument("--frame-min", type=int, default=64, help="minimum frame size in bytes")
+    parser.add_argument("--frame-max", type=int, default=1514, help="maximum frame size in bytes")
+    parser.add_argument("--spi-rate", type=float, default=0, help="SPI events per second, 0 disables them")
+    parser.add_argument("--spi-size", type=int, default=32, help="SPI event size in bytes")
+    parser.add_argument("--spi-echo", action="store_true", help="echo every SPI send back as an SPI event")
+    parser.add_argument("--response-delay-ms", type=float, default=0, help="delay before answering each command")
+    parser.add_argument("--response-jitter-ms", type=float, default=0, help="uniform jitter added to the delay")
+    parser.add_argument("--max-pending-events", type=int, default=1024, help="events queued before dropping")
+    parser.add_argument("--config-bits", type=lambda s: int(s, 0), default=0, help="answer to the config bits query")
+    parser.add_argument("--scan-aps", type=int, default=0, help="number of access points returned by scans")
+    parser.add_argument("--stations", type=int, default=0, help="number of stations connected to the AP")
+    parser.add_argument("--tap", help="bridge the frames of one interface to this TAP device (needs CAP_NET_ADMIN)")
+    parser.add_argument("--tap-side", choices=("ap", "sta"), default="ap", help="interface bridged to --tap")
+    parser.add_argument("--sink-port", type=int, default=0, help="run TCP and UDP discard servers on this port")
+    parser.add_argument("--pcap-prefix", help="write frames streamed by ps_pcap_start to <prefix>-<path>.pcap")
+    parser.add_argument("--replay", help="serve the responses and events of a capture log (see ps_capture_start)")
+    parser.add_argument("--replay-speed", choices=("original", "max"), default="original",
+                        help="replay events at their recorded pace or back to back")
+    parser.add_argument("--report-every", type=float, default=0, help="print a JSON stats line every N seconds")
+    args = parser.parse_args(argv)
+
+    if args.frame_min > args.frame_max:
+        parser.error("--frame-min must not be greater than --frame-max")
+    return args
+
+
+def main(argv=None):
+    args = parse_args(argv)
+    link = Link(args.link)
+    link.open()
+    controller = Controller(link, args)
+
+    if args.event_rate > 0:
+        threading.Thread(target=controller.inject_frames, daemon=True).start()
+    if args.spi_rate > 0:
+        threading.Thread(target=controller.inject_spi, daemon=True).start()
+    if controller.replay:
+        threading.Thread(target=controller.replay_events, daemon=True).start()
+    if controller.tap:
+        threading.Thread(target=controller.forward_tap, daemon=True).start()
+    if args.sink_port:
+        controller.sink = Sink(args.sink_port)
+        controller.sink.start()
+    if args.report_every > 0:
+        def reporter():
+            while True:
+                time.sleep(args.report_every)
+                controller.report()
+        threading.Thread(target=reporter, daemon=True).start()
+
+    try:
+        controller.serve()
+    except (EOFError, KeyboardInterrupt):
+        pass
+    finally:
+        controller.report()
+
+
+if __name__ == "__main__":
+    main()